@@ -9,8 +9,9 @@
 #define RADIUS3 0.2
 #define MARGIN  1.0
 
-#define NB_STEPS        750
-#define NB_SUBSTEPS       1
+#define MAX_STEPS      1500
+#define WINDOW           50 // steps over which the disks must hold
+#define COUNT_CHANGE      5 // the same number of electrons, within that.
 #define ELECTRONS_RATIO   2
 
 #define PLOT_V_MIN      -10
@@ -33,6 +34,7 @@ int main(int argc, char* argv[]) {
   auto group = elec::set ({left,bar,right});
 
   elec::World world;
+  world.set_seed(m.seed());
   auto group_idf = (world += group);
   world.build_protons(group_idf);
   world.add_electrons_random(left, ELECTRONS_RATIO * world.nb_protons(group_idf));
@@ -69,13 +71,20 @@ int main(int argc, char* argv[]) {
 
   m.generate(display);
 
-  for(unsigned int step = 0; step < NB_STEPS; ++step) {
-    std::cerr << std::setw(5) << step+1 << "/" << NB_STEPS << "    \r" << std::flush;
-    std::cout << display(flags, ccmpl::nofile() , ccmpl::nofile());
-    for(unsigned int substep = 0; substep < NB_SUBSTEPS; ++substep)
-      world.move([&world](const elec::Point& p) -> elec::Point {return world.E(p);});
-  }
-  std::cerr << std::endl;
+  // Let us run until the charge of each disk settles.
+  elec::Convergence until;
+  until.regions      = {left, right};
+  until.count_change = COUNT_CHANGE;
+  until.window       = WINDOW;
+  until.max_steps    = MAX_STEPS;
+
+  std::cout << display(flags, ccmpl::nofile() , ccmpl::nofile());
+  unsigned int step = 0;
+  auto nb_steps = world.run(until, [&display, &flags, &step](const elec::MoveStats& stats) {
+      std::cerr << std::setw(5) << ++step << " : " << stats << "    \r" << std::flush;
+      std::cout << display(flags, ccmpl::nofile() , ccmpl::nofile());
+    });
+  std::cerr << std::endl << "settled after " << nb_steps << " steps" << std::endl;
   std::cout << ccmpl::stop;
   
   return 0;
@@ -28,6 +28,7 @@ int main(int argc, char* argv[]) {
 			 WIRE_RADIUS, true, elec::metal());
 
   elec::World world;
+  world.set_seed(m.seed());
   auto wire_idf = (world += wire);
   world.build_protons(wire_idf);
   world.build_electrons(wire_idf);
@@ -55,7 +56,7 @@ int main(int argc, char* argv[]) {
     std::cerr << std::setw(5) << step+1 << "/" << NB_STEPS << "    \r" << std::flush;
     std::cout << display(flags, ccmpl::nofile() , ccmpl::nofile());
     for(unsigned int substep = 0; substep < NB_SUBSTEPS; ++substep)
-      world.move([&world](const elec::Point& p) -> elec::Point {return world.E(p);});
+      world.move();
   }
   std::cerr << std::endl;
   std::cout << ccmpl::stop;
@@ -2,7 +2,22 @@
 
 #include <elecDipole.hpp>
 #include <elecParams.hpp>
+#include <elecRandom.hpp>
 #include <elecPoint.hpp>
 #include <elecParticle.hpp>
+#include <elecKernels.hpp>
+#include <elecParticles.hpp>
+#include <elecField.hpp>
+#include <elecTaylor.hpp>
+#include <elecQuadtree.hpp>
+#include <elecFMM.hpp>
+#include <elecGrid.hpp>
+#include <elecFFT.hpp>
+#include <elecMesh.hpp>
+#include <elecThreads.hpp>
+#include <elecNeighbours.hpp>
+#include <elecBVH.hpp>
+#include <elecCompiled.hpp>
+#include <elecRaster.hpp>
 #include <elecWorld.hpp>
 #include <elecMain.hpp>
@@ -6,6 +6,9 @@
 #include <limits>
 #include <iterator>
 #include <initializer_list>
+#include <algorithm>
+#include <cmath>
+#include <elecBVH.hpp>
 
 namespace elec {
   
@@ -14,6 +17,24 @@ namespace elec {
 
     std::vector<Point> pattern;
 
+    /* The pattern is scaled and rotated along the motion D (bounded
+       by elecMAX_VARIATION), and centered at its middle O. */
+    void frame(const Point& A, const Point& BB, Point& O, Point& D) const {
+      double norm_dd_2 = d2(A,BB);
+      Point B;
+      if(norm_dd_2 < elecMAX_VARIATION*elecMAX_VARIATION)
+	B = BB;
+      else
+	B = A+(*(BB-A))*elecMAX_VARIATION;
+      D = B-A;
+      O = (A+B)*.5;
+    }
+
+    static Point place(const Point& M, const Point& O, const Point& D) {
+      return {M.x*D.x - M.y*D.y + O.x,
+	      M.x*D.y + M.y*D.x + O.y};
+    }
+
   public:
 
     Wall(unsigned int nb_steps) {
@@ -44,34 +65,107 @@ namespace elec {
        std::pair<Point,double> sc; if(score(x,sc) register x;*/
     template<typename ScoreFunc>
     std::vector<std::pair<Point,std::pair<Point,double>>> operator()(const Point& A, const Point& BB, const ScoreFunc& score) const {
-      double norm_dd_2 = d2(A,BB);
-      Point B;
-      if(norm_dd_2 < elecMAX_VARIATION*elecMAX_VARIATION)
-	B = BB;
-      else
-	B = A+(*(BB-A))*elecMAX_VARIATION;
-	
       std::vector<std::pair<Point,std::pair<Point,double>>> res;
       auto out = std::back_inserter(res);
-      std::pair<Point,double> score_value;
-
-      auto D = B-A;
-      auto O = (A+B)*.5;
-      auto f = [&O,&D](const Point& M) -> Point {
-	return {M.x*D.x - M.y*D.y + O.x,
-		M.x*D.y + M.y*D.x + O.y};
-      };
+      visit(A, BB, score,
+	    [&out](const Point& p, const std::pair<Point,double>& sc) -> bool {
+	      *(out++) = {p,sc};
+	      return false;
+	    });
+      return res;
+    }
 
+    /**
+     * Same as operator(), but each scored motion is given to
+     * visitor(point,score) as soon as it is computed, in the pattern
+     * order. The traversal stops when the visitor returns true, so
+     * that the remaining motions are not scored. It returns whether
+     * the traversal has been stopped.
+     */
+    template<typename ScoreFunc, typename Visitor>
+    bool visit(const Point& A, const Point& BB, const ScoreFunc& score, const Visitor& visitor) const {
+      Point O, D;
+      frame(A, BB, O, D);
+      std::pair<Point,double> score_value;
       for(auto& X : pattern) {
-	auto XX = f(X);
-	if(score(XX,score_value))
-	  *(out++) = {XX,score_value};
+	auto XX = place(X, O, D);
+	if(score(XX,score_value) && visitor(XX,score_value))
+	  return true;
       }
+      return false;
+    }
 
-      return res;
+    /**
+     * Sets out to the candidate motions, in the pattern order, without
+     * scoring them. They lie in the disk whose diameter is the
+     * (bounded) motion from A to BB.
+     */
+    void motions(const Point& A, const Point& BB, std::vector<Point>& out) const {
+      Point O, D;
+      frame(A, BB, O, D);
+      out.clear();
+      for(auto& X : pattern)
+	out.push_back(place(X, O, D));
     }
   };
 
+  /**
+   * All the properties of an area at some point. Outside of the area,
+   * they are {false, 0, 0, the largest double}.
+   */
+  struct Properties {
+    bool   in       = false;
+    double mobility = 0;
+    double density  = 0;
+    double min_d2   = std::numeric_limits<double>::max();
+
+    /* The properties of the union of both areas. */
+    void merge(const Properties& p) {
+      in       = in || p.in;
+      mobility = std::max(mobility, p.mobility);
+      density  = std::max(density,  p.density);
+      min_d2   = std::min(min_d2,   p.min_d2);
+    }
+  };
+
+  /* Signed distances to elementary shapes (negative inside), with
+     their gradient g, the outward normal at the closest border point. */
+
+  inline double disk_distance(const Point& O, double r, const Point& pos, Point& g) {
+    Point  v = pos - O;
+    double l = std::sqrt(v*v);
+    g = l > 0 ? v/l : Point(1,0);
+    return l - r;
+  }
+
+  inline double box_distance(const Point& min, const Point& max, const Point& pos, Point& g) {
+    Point  v  = pos - .5*(min+max);
+    double sx = v.x < 0 ? -1 : 1;
+    double sy = v.y < 0 ? -1 : 1;
+    double qx = std::fabs(v.x) - .5*(max.x-min.x);
+    double qy = std::fabs(v.y) - .5*(max.y-min.y);
+    if(qx > 0 || qy > 0) {
+      Point  o(std::max(qx,0.)*sx, std::max(qy,0.)*sy);
+      double l = std::sqrt(o*o);
+      g = o/l;
+      return l;
+    }
+    if(qx > qy) {
+      g = {sx,0};
+      return qx;
+    }
+    g = {0,sy};
+    return qy;
+  }
+
+  /* u is the unit vector from A to the other end, at distance l. */
+  inline double segment_distance(const Point& A, const Point& u, double l, double r, const Point& pos, Point& g) {
+    double lambda = std::max(0., std::min(l, u*(pos-A)));
+    Point  v      = pos - (A + u*lambda);
+    double n      = std::sqrt(v*v);
+    g = n > 0 ? v/n : Point(-u.y, u.x);
+    return n - r;
+  }
   
   class Area {
   public:
@@ -84,6 +178,44 @@ namespace elec {
     virtual double                 density     (const Point& pos) const = 0;
     virtual double                 min_d2      (const Point& pos) const = 0;
     virtual std::pair<Point,Point> bbox        ()                 const = 0;
+
+    /**
+     * in, mobility, density and min_d2 at once, in a single traversal
+     * of the area.
+     */
+    virtual Properties             query       (const Point& pos) const {
+      Properties res;
+      res.in       = in(pos);
+      res.mobility = mobility(pos);
+      res.density  = density(pos);
+      res.min_d2   = min_d2(pos);
+      return res;
+    }
+
+    /**
+     * The largest finite min_d2 of the materials of the area, 0 if
+     * unknown. It gives the scale of the distances between electrons.
+     */
+    virtual double                 largest_min_d2()               const {return 0;}
+
+    /**
+     * The signed distance d from pos to the border of the area
+     * (negative inside), with its gradient in g. Only the distances
+     * below bound matter: beyond, any value of the right sign and at
+     * least bound may be returned. Inside a union, the depth may be
+     * underestimated.
+     *
+     * When g is not null, the part of the area within bound of pos
+     * lies on the side g*(p-pos) <= -d of the tangent to the border,
+     * as for a convex shape. g is null when this is not known, for
+     * instance when several shapes are close to pos. An area which
+     * does not know its distance returns 0 with a null gradient (the
+     * default).
+     */
+    virtual double                 distance    (const Point&, double, Point& g) const {
+      g = {0,0};
+      return 0;
+    }
   };
 
   using AreaRef = std::shared_ptr<Area>;
@@ -103,6 +235,11 @@ namespace elec {
     virtual double                 mobility    (const Point& pos) const override {return content->mobility   (backward(pos));}
     virtual double                 density     (const Point& pos) const override {return content->density    (backward(pos));}
     virtual double                 min_d2      (const Point& pos) const override {return content->min_d2     (backward(pos));}
+    virtual Properties             query       (const Point& pos) const override {return content->query      (backward(pos));}
+    virtual double                 distance    (const Point& pos, double bound, Point& g) const override {
+      return content->distance(backward(pos), bound, g);
+    }
+    virtual double                 largest_min_d2()               const override {return content->largest_min_d2();}
     virtual std::pair<Point,Point> bbox        ()                 const override {
       auto bb = content->bbox();
       return {forward(bb.first),forward(bb.second)};
@@ -128,6 +265,13 @@ namespace elec {
     virtual double                 mobility    (const Point& pos) const override {return content->mobility   (backward(pos));}
     virtual double                 density     (const Point& pos) const override {return content->density    (backward(pos));}
     virtual double                 min_d2      (const Point& pos) const override {return content->min_d2     (backward(pos));}
+    virtual Properties             query       (const Point& pos) const override {return content->query      (backward(pos));}
+    virtual double                 distance    (const Point& pos, double bound, Point& g) const override {
+      double res = content->distance(backward(pos), bound, g);
+      g.x = -g.x;
+      return res;
+    }
+    virtual double                 largest_min_d2()               const override {return content->largest_min_d2();}
     virtual std::pair<Point,Point> bbox        ()                 const override {
       auto bb   = content->bbox();
       auto fmin = forward(bb.first);
@@ -157,6 +301,13 @@ namespace elec {
     virtual double                 mobility    (const Point& pos) const override {return content->mobility   (backward(pos));}
     virtual double                 density     (const Point& pos) const override {return content->density    (backward(pos));}
     virtual double                 min_d2      (const Point& pos) const override {return content->min_d2     (backward(pos));}
+    virtual Properties             query       (const Point& pos) const override {return content->query      (backward(pos));}
+    virtual double                 distance    (const Point& pos, double bound, Point& g) const override {
+      double res = content->distance(backward(pos), bound, g);
+      g.y = -g.y;
+      return res;
+    }
+    virtual double                 largest_min_d2()               const override {return content->largest_min_d2();}
     virtual std::pair<Point,Point> bbox        ()                 const override {
       auto bb   = content->bbox();
       auto fmin = forward(bb.first);
@@ -172,53 +323,105 @@ namespace elec {
 
 
 
+  /**
+   * The union of areas. The queries only visit the areas whose
+   * bounding box contains the point (see BVH), so an area is expected
+   * to be empty (not in, null mobility and density, no min_d2)
+   * outside of its box. The index is rebuilt when an area is added
+   * with +=.
+   */
   class AreaSet : public Area {
+  private:
+
+    BVH index;
+
+    void reindex() {
+      std::vector<std::pair<Point,Point>> boxes;
+      for(auto& e_ptr : areas)
+	boxes.push_back(e_ptr->bbox());
+      index.build(boxes);
+    }
+
   public:
     
     std::vector<AreaRef> areas;
-    AreaSet() : Area(), areas() {}
+    AreaSet() : Area(), index(), areas() {}
 
-    AreaSet(const std::initializer_list<AreaRef>& lst) : Area(), areas(lst) {}
+    AreaSet(const std::initializer_list<AreaRef>& lst) : Area(), index(), areas(lst) {
+      reindex();
+    }
 
     virtual ~AreaSet() {}
 
     void operator+=(elec::AreaRef area) {
       areas.push_back(area);
+      reindex();
     }
 
     virtual bool in(const Point& pos) const override {
-      for(auto& e_ptr : areas)
-	if(e_ptr->in(pos)) 
-	  return true;
-      return false;
+      return index.visit(pos, [this, &pos](unsigned int i) {return areas[i]->in(pos);});
     }
 
     virtual double mobility(const Point& pos) const override  {
       double res = 0;
-      for(auto& e_ptr : areas)
-	res = std::max(res,e_ptr->mobility(pos));
+      index.visit(pos, [this, &pos, &res](unsigned int i) {res = std::max(res,areas[i]->mobility(pos)); return false;});
       return res;
     }
 
     virtual double density(const Point& pos) const override  {
       double res = 0;
-      for(auto& e_ptr : areas)
-	res = std::max(res,e_ptr->density(pos));
+      index.visit(pos, [this, &pos, &res](unsigned int i) {res = std::max(res,areas[i]->density(pos)); return false;});
       return res;
     }
 
     virtual double min_d2(const Point& pos) const override  {
       double res = std::numeric_limits<double>::max();
+      index.visit(pos, [this, &pos, &res](unsigned int i) {res = std::min(res,areas[i]->min_d2(pos)); return false;});
+      return res;
+    }
+
+    virtual Properties query(const Point& pos) const override  {
+      Properties res;
+      index.visit(pos, [this, &pos, &res](unsigned int i) {res.merge(areas[i]->query(pos)); return false;});
+      return res;
+    }
+
+    /* The union is the smallest distance, the areas farther than
+       bound being skipped. */
+    virtual double distance(const Point& pos, double bound, Point& g) const override {
+      double res = bound;
+      Point  b(bound, bound);
+      unsigned int near = 0;
+      g = {0,0};
+      index.visit(pos - b, pos + b, [this, &pos, bound, &res, &g, &near](unsigned int i) {
+	  Point  gi;
+	  double d = areas[i]->distance(pos, bound, gi);
+	  if(d < bound)
+	    ++near;
+	  if(d < res) {
+	    res = d;
+	    g   = gi;
+	  }
+	  return false;
+	});
+      if(near > 1)
+	g = {0,0};
+      return res;
+    }
+
+    virtual double largest_min_d2() const override {
+      double res = 0;
       for(auto& e_ptr : areas)
-	res = std::min(res,e_ptr->min_d2(pos));
+	res = std::max(res,e_ptr->largest_min_d2());
       return res;
     }
 
+    /* An empty set has an empty box, with min > max. */
     virtual std::pair<Point,Point> bbox() const override {
-      auto iter = areas.begin();
-      auto res  = (*(iter++))->bbox();
-      while(iter!=areas.end()) {
-	auto bb = (*(iter++))->bbox();
+      std::pair<Point,Point> res = {Point( std::numeric_limits<double>::max(),  std::numeric_limits<double>::max()),
+				    Point(-std::numeric_limits<double>::max(), -std::numeric_limits<double>::max())};
+      for(auto& e_ptr : areas) {
+	auto bb = e_ptr->bbox();
 	res.first  = min(res.first, bb.first);
 	res.second = max(res.second,bb.second);
       }
@@ -268,6 +471,19 @@ namespace elec {
       if(in(pos)) return material.min_d2;
       return std::numeric_limits<double>::max();
     };
+    virtual Properties query(const Point& pos) const override {
+      Properties res;
+      if(in(pos)) {
+	res.in       = true;
+	res.mobility = material.mobility;
+	res.density  = material.density;
+	res.min_d2   = material.min_d2;
+      }
+      return res;
+    }
+    virtual double largest_min_d2() const override {
+      return material.min_d2;
+    }
   };
 
   class Disk : public Conductor {
@@ -279,6 +495,7 @@ namespace elec {
     virtual ~Disk() {}
     virtual bool                   in      (const Point& pos) const override {return d2(pos,O)<=r2;}
     virtual std::pair<Point,Point> bbox    ()                 const override {return {O-Point(r,r),O+Point(r,r)};}
+    virtual double                 distance(const Point& pos, double, Point& g) const override {return disk_distance(O, r, pos, g);}
   };
 
   AreaRef disk(const Point& O, double r, const Material& mat) {
@@ -292,62 +509,100 @@ namespace elec {
     virtual ~Box() {}
     virtual bool                   in      (const Point& pos) const override {return min <= pos && pos <= max;}
     virtual std::pair<Point,Point> bbox    ()                 const override {return {min,max};}
+    virtual double                 distance(const Point& pos, double, Point& g) const override {return box_distance(min, max, pos, g);}
   };
 
   AreaRef box(const Point& min, const Point& max, const Material& mat) {
     return AreaRef(static_cast<Area*>(new Box(min,max,mat)));
   }
 
+  /**
+   * A polyline of thickness 2r. The segments are precomputed and
+   * indexed by a BVH, so that in() only tests the segments close to
+   * the point.
+   */
   class Wire : public Conductor {
+  public:
+
+    struct Segment {
+      Point  A, B;
+      Point  u;    // unit vector from A to B.
+      double l;    // length.
+    };
+
   private:
     Point min,max;
     double r2;
+    std::vector<Segment> segs;
+    BVH index;
   public:
     double r;
     std::vector<Point> vertices;
     Wire(const std::vector<Point>& vertices, double r, bool loop, const Material& mat)
-      : Conductor(mat), r2(r*r), r(r), vertices(vertices) {
+      : Conductor(mat), min(), max(), r2(r*r), segs(), index(), r(r), vertices(vertices) {
       min = *(vertices.cbegin());
       max = min;
       for(auto& pt : vertices) {
-	if(pt.x < min.x) min.x = pt.x;
-	else if(pt.x > max.x) max.x = pt.x;
-	if(pt.y < min.y) min.y = pt.y;
-	else if(pt.y > max.y) max.y = pt.y;
+	min = elec::min(min, pt);
+	max = elec::max(max, pt);
       }
       min -= {r,r};
       max += {r,r};
       
       if(loop)
 	this->vertices.push_back(*(vertices.cbegin()));
+
+      std::vector<std::pair<Point,Point>> boxes;
+      for(auto ita = this->vertices.begin(), itb = ita+1; itb != this->vertices.end(); ita = itb++) {
+	Point A = *ita;
+	Point B = *itb;
+	segs.push_back({A, B, *(B-A), sqrt(d2(A,B))});
+	boxes.push_back({elec::min(A,B) - Point(r,r), elec::max(A,B) + Point(r,r)});
+      }
+      index.build(boxes);
     }
     virtual ~Wire() {}
+
+    const std::vector<Segment>& segments() const {return segs;}
+
+    /* Squared distance from pos to the segment. */
+    static double distance2(const Segment& s, const Point& pos) {
+      double lambda = s.u*(pos-s.A);
+      if(lambda < 0)
+	return d2(s.A,pos);
+      else if(lambda > s.l)
+	return d2(s.B,pos);
+      else
+	return d2(s.A+s.u*lambda, pos);
+    }
     
     virtual bool in(const Point& pos) const override {
-      auto ita = vertices.begin();
-      double r2 = r*r;
-      for(auto itb = ita+1; itb != vertices.end(); ita = itb++) {
-	Point   A = *ita;
-	Point   B = *itb;
-	Point   u = *(B-A);
-	double l2 = d2(A,B);
-	double  l = sqrt(l2);
-	double  dd;
-
-	double lambda = u*(pos-A);
-	if(lambda < 0)
-	  dd = d2(A,pos);
-	else if(lambda > l)
-	  dd = d2(B,pos);
-	else
-	  dd = d2(A+u*lambda, pos);
-	if(dd < r2)
-	  return true;
-      }
-      return false;
+      return index.visit(pos, [this, &pos](unsigned int i) {return distance2(segs[i], pos) < r2;});
     }
     
     virtual std::pair<Point,Point> bbox() const override {return {min,max};}
+
+    /* The segments farther than bound are skipped. */
+    virtual double distance(const Point& pos, double bound, Point& g) const override {
+      double res = bound;
+      Point  b(bound, bound);
+      unsigned int near = 0;
+      g = {0,0};
+      index.visit(pos - b, pos + b, [this, &pos, bound, &res, &g, &near](unsigned int i) {
+	  Point  gi;
+	  double d = segment_distance(segs[i].A, segs[i].u, segs[i].l, r, pos, gi);
+	  if(d < bound)
+	    ++near;
+	  if(d < res) {
+	    res = d;
+	    g   = gi;
+	  }
+	  return false;
+	});
+      if(near > 1)
+	g = {0,0};
+      return res;
+    }
   };
 
   AreaRef wire(const std::vector<Point>& vertices, double r, bool loop, const Material& mat) {
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#include <elecPoint.hpp>
+
+/* Items per leaf of a BVH. */
+#define elecBVH_LEAF_SIZE 4
+/* Relative enlargement of the boxes, against rounding errors. */
+#define elecBVH_MARGIN 1e-9
+
+namespace elec {
+
+  /**
+   * Bounding volume hierarchy over a set of boxes, for point queries.
+   * The tree is built by splitting the boxes at the median of their
+   * centers, along the largest extent, until elecBVH_LEAF_SIZE boxes
+   * are left. The boxes are slightly enlarged, so that a point which
+   * is inside an area up to the rounding errors of its transforms is
+   * inside its box. Empty boxes (min > max) are never visited.
+   */
+  class BVH {
+  private:
+
+    using Box = std::pair<Point,Point>;
+
+    struct Node {
+      Box          box;
+      unsigned int first, count; // items, if count > 0 (leaf).
+      unsigned int right;        // right child, the left one follows.
+    };
+
+    std::vector<Box>          boxes;
+    std::vector<Node>         nodes;
+    std::vector<unsigned int> items;
+
+    static bool contains(const Box& b, const Point& p) {
+      return b.first <= p && p <= b.second;
+    }
+
+    Point center(unsigned int i) const {
+      return .5*(boxes[i].first + boxes[i].second);
+    }
+
+    unsigned int build(unsigned int first, unsigned int count) {
+      unsigned int n = nodes.size();
+      nodes.push_back({boxes[items[first]], first, count, 0});
+      for(unsigned int k = first+1; k < first+count; ++k) {
+	nodes[n].box.first  = min(nodes[n].box.first,  boxes[items[k]].first);
+	nodes[n].box.second = max(nodes[n].box.second, boxes[items[k]].second);
+      }
+      if(count <= elecBVH_LEAF_SIZE)
+	return n;
+
+      Point cmin = center(items[first]);
+      Point cmax = cmin;
+      for(unsigned int k = first+1; k < first+count; ++k) {
+	cmin = min(cmin, center(items[k]));
+	cmax = max(cmax, center(items[k]));
+      }
+      bool along_x = cmax.x - cmin.x >= cmax.y - cmin.y;
+      unsigned int half = count/2;
+      std::nth_element(items.begin()+first, items.begin()+first+half, items.begin()+first+count,
+		       [this, along_x](unsigned int a, unsigned int b) {
+			 Point ca = center(a);
+			 Point cb = center(b);
+			 return along_x ? ca.x < cb.x : ca.y < cb.y;
+		       });
+      nodes[n].count = 0;
+      build(first, half);
+      unsigned int right = build(first+half, count-half);
+      nodes[n].right = right;
+      return n;
+    }
+
+  public:
+
+    BVH() : boxes(), nodes(), items() {}
+
+    /**
+     * Indexes the boxes, the item i being boxes[i].
+     */
+    void build(const std::vector<Box>& boxes) {
+      this->boxes.clear();
+      nodes.clear();
+      items.clear();
+      for(unsigned int i = 0; i < boxes.size(); ++i) {
+	Box b = boxes[i];
+	if(!(b.first <= b.second))
+	  b = {Point( std::numeric_limits<double>::max(),  std::numeric_limits<double>::max()),
+	       Point(-std::numeric_limits<double>::max(), -std::numeric_limits<double>::max())};
+	else {
+	  double scale  = std::max({std::fabs(b.first.x), std::fabs(b.first.y), std::fabs(b.second.x), std::fabs(b.second.y)});
+	  double margin = elecBVH_MARGIN*(1 + scale);
+	  b.first  -= {margin, margin};
+	  b.second += {margin, margin};
+	  items.push_back(i);
+	}
+	this->boxes.push_back(b);
+      }
+      if(!items.empty())
+	build(0, items.size());
+    }
+
+    /**
+     * Calls fn(i) for each item i whose box contains p, until fn
+     * returns true. Returns whether it did.
+     */
+    template<typename Fn>
+    bool visit(const Point& p, const Fn& fn) const {
+      if(nodes.empty())
+	return false;
+      unsigned int stack[64];
+      unsigned int top = 0;
+      stack[top++] = 0;
+      while(top > 0) {
+	const Node& node = nodes[stack[--top]];
+	if(!contains(node.box, p))
+	  continue;
+	if(node.count > 0) {
+	  for(unsigned int k = node.first; k < node.first + node.count; ++k)
+	    if(contains(boxes[items[k]], p) && fn(items[k]))
+	      return true;
+	}
+	else {
+	  unsigned int left = &node - nodes.data() + 1;
+	  stack[top++] = node.right;
+	  stack[top++] = left;
+	}
+      }
+      return false;
+    }
+
+    /**
+     * Calls fn(i) for each item i whose box overlaps [bmin,bmax],
+     * until fn returns true. Returns whether it did.
+     */
+    template<typename Fn>
+    bool visit(const Point& bmin, const Point& bmax, const Fn& fn) const {
+      if(nodes.empty())
+	return false;
+      auto overlaps = [&bmin, &bmax](const Box& b) {return b.first <= bmax && bmin <= b.second;};
+      unsigned int stack[64];
+      unsigned int top = 0;
+      stack[top++] = 0;
+      while(top > 0) {
+	const Node& node = nodes[stack[--top]];
+	if(!overlaps(node.box))
+	  continue;
+	if(node.count > 0) {
+	  for(unsigned int k = node.first; k < node.first + node.count; ++k)
+	    if(overlaps(boxes[items[k]]) && fn(items[k]))
+	      return true;
+	}
+	else {
+	  unsigned int left = &node - nodes.data() + 1;
+	  stack[top++] = node.right;
+	  stack[top++] = left;
+	}
+      }
+      return false;
+    }
+  };
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <typeinfo>
+#include <algorithm>
+#include <cmath>
+
+#include <elecPoint.hpp>
+#include <elecArea.hpp>
+#include <elecBVH.hpp>
+
+namespace elec {
+
+  /**
+   * An area tree flattened into tables of primitives, queried without
+   * virtual calls. The transforms (Translate, Hflip, Vflip) become
+   * frames: at query time, the point is expressed in each frame by
+   * replaying the transforms of the tree, in the same order, so that
+   * the primitives see exactly the same coordinates as in the tree.
+   * The AreaSet reductions (any, max, min) are associative, so that
+   * nested sets are merged into a single one. The results are thus
+   * the ones of the tree, as long as the mobilities and densities are
+   * not negative. As in AreaSet, the primitives are indexed by a BVH
+   * on their bounding boxes.
+   *
+   * Disks, boxes and wire segments are compiled, each segment being
+   * indexed on its own. Any other kind of area is kept as an opaque
+   * primitive, queried through its virtual methods.
+   */
+  class CompiledArea : public Area {
+  private:
+
+    enum class Op {identity, translate, hflip, vflip};
+    enum class Kind {disk, box, segment, opaque};
+
+    struct Frame {
+      unsigned int parent;
+      Op           op;
+      Point        param;  // t, or (xx,0) or (0,yy).
+    };
+
+    struct DiskPrim {
+      Point        O;
+      double       r, r2;
+      unsigned int frame;
+      Material     material;
+    };
+
+    struct BoxPrim {
+      Point        min, max;
+      unsigned int frame;
+      Material     material;
+    };
+
+    struct SegmentPrim {
+      Wire::Segment segment;
+      double        r, r2;
+      unsigned int  frame;
+      Material      material;
+    };
+
+    struct OpaquePrim {
+      AreaRef      area;
+      unsigned int frame;
+    };
+
+    struct Prim {
+      Kind         kind;
+      unsigned int idx;
+    };
+
+    AreaRef                 root;
+    std::vector<Frame>      frames;
+    std::vector<DiskPrim>   disks;
+    std::vector<BoxPrim>    boxes;
+    std::vector<SegmentPrim> segments;
+    std::vector<OpaquePrim> opaques;
+    std::vector<Prim>       prims;
+    std::vector<std::pair<Point,Point>> prim_boxes;
+    BVH                     index;
+
+    unsigned int add_frame(unsigned int parent, Op op, const Point& param) {
+      frames.push_back({parent, op, param});
+      return frames.size() - 1;
+    }
+
+    /* Maps p from the frame f to the root. */
+    Point forward(unsigned int f, Point p) const {
+      for(; f != 0; f = frames[f].parent) {
+	const Frame& fr = frames[f];
+	switch(fr.op) {
+	case Op::translate : p = p + fr.param;             break;
+	case Op::hflip     : p = {fr.param.x - p.x, p.y};  break;
+	case Op::vflip     : p = {p.x, fr.param.y - p.y};  break;
+	default            :                               break;
+	}
+      }
+      return p;
+    }
+
+    /* Maps the direction v from the frame f to the root. */
+    Point forward_direction(unsigned int f, Point v) const {
+      for(; f != 0; f = frames[f].parent)
+	switch(frames[f].op) {
+	case Op::hflip : v.x = -v.x; break;
+	case Op::vflip : v.y = -v.y; break;
+	default        :             break;
+	}
+      return v;
+    }
+
+    /* Maps p from the root to the frame f, with the operations of the tree. */
+    Point backward(unsigned int f, const Point& p) const {
+      if(f == 0)
+	return p;
+      const Frame& fr = frames[f];
+      Point        q  = backward(fr.parent, p);
+      switch(fr.op) {
+      case Op::translate : return q - fr.param;
+      case Op::hflip     : return {fr.param.x - q.x, q.y};
+      case Op::vflip     : return {q.x, fr.param.y - q.y};
+      default            : return q;
+      }
+    }
+
+    void add_prim(Kind kind, unsigned int idx, const std::pair<Point,Point>& bb, unsigned int frame) {
+      prims.push_back({kind, idx});
+      if(!(bb.first <= bb.second)) {
+	prim_boxes.push_back(bb);
+	return;
+      }
+      Point a = forward(frame, bb.first);
+      Point b = forward(frame, bb.second);
+      prim_boxes.push_back({min(a,b), max(a,b)});
+    }
+
+    void add(AreaRef a, unsigned int frame) {
+      const Area& area = *a;
+      const std::type_info& type = typeid(area);
+      if(type == typeid(Translate)) {
+	auto& t = static_cast<const Translate&>(area);
+	add(t.content, add_frame(frame, Op::translate, t.t));
+      }
+      else if(type == typeid(Hflip)) {
+	auto& h = static_cast<const Hflip&>(area);
+	add(h.content, add_frame(frame, Op::hflip, {h.xx, 0}));
+      }
+      else if(type == typeid(Vflip)) {
+	auto& v = static_cast<const Vflip&>(area);
+	add(v.content, add_frame(frame, Op::vflip, {0, v.yy}));
+      }
+      else if(type == typeid(AreaSet)) {
+	for(auto& child : static_cast<const AreaSet&>(area).areas)
+	  add(child, frame);
+      }
+      else if(type == typeid(Disk)) {
+	auto& d = static_cast<const Disk&>(area);
+	add_prim(Kind::disk, disks.size(), area.bbox(), frame);
+	disks.push_back({d.O, d.r, d.r2, frame, d.material});
+      }
+      else if(type == typeid(Box)) {
+	auto& b = static_cast<const Box&>(area);
+	add_prim(Kind::box, boxes.size(), area.bbox(), frame);
+	boxes.push_back({b.min, b.max, frame, b.material});
+      }
+      else if(type == typeid(Wire)) {
+	auto& w = static_cast<const Wire&>(area);
+	Point  r(w.r, w.r);
+	for(auto& seg : w.segments()) {
+	  add_prim(Kind::segment, segments.size(), {min(seg.A,seg.B) - r, max(seg.A,seg.B) + r}, frame);
+	  segments.push_back({seg, w.r, w.r*w.r, frame, w.material});
+	}
+      }
+      else {
+	add_prim(Kind::opaque, opaques.size(), area.bbox(), frame);
+	opaques.push_back({a, frame});
+      }
+    }
+
+    static void merge(Properties& res, const Material& m) {
+      res.in       = true;
+      res.mobility = std::max(res.mobility, m.mobility);
+      res.density  = std::max(res.density,  m.density);
+      res.min_d2   = std::min(res.min_d2,   m.min_d2);
+    }
+
+    /* The rectangle [a,b] of the root frame, in the frame f. */
+    void backward(unsigned int f, const Point& a, const Point& b, Point& fa, Point& fb) const {
+      Point p = backward(f, a);
+      Point q = backward(f, b);
+      fa = min(p, q);
+      fb = max(p, q);
+    }
+
+    unsigned int frame_of(const Prim& pr) const {
+      switch(pr.kind) {
+      case Kind::disk    : return disks   [pr.idx].frame;
+      case Kind::box     : return boxes   [pr.idx].frame;
+      case Kind::segment : return segments[pr.idx].frame;
+      default            : return opaques [pr.idx].frame;
+      }
+    }
+
+    /* Not for opaque primitives. */
+    const Material& material_of(const Prim& pr) const {
+      switch(pr.kind) {
+      case Kind::disk    : return disks   [pr.idx].material;
+      case Kind::box     : return boxes   [pr.idx].material;
+      default            : return segments[pr.idx].material;
+      }
+    }
+
+    /* 1 if the primitive contains the whole rectangle [a,b] (in the
+       frame of the primitive), -1 if it does not meet it, 0 if it may
+       cross it. */
+    int cover(const Prim& pr, const Point& a, const Point& b) const {
+      switch(pr.kind) {
+      case Kind::disk : {
+	const DiskPrim& d  = disks[pr.idx];
+	double          fx = std::max(std::fabs(a.x - d.O.x), std::fabs(b.x - d.O.x));
+	double          fy = std::max(std::fabs(a.y - d.O.y), std::fabs(b.y - d.O.y));
+	if(fx*fx + fy*fy < d.r2)
+	  return 1;
+	if(d2(max(a, min(b, d.O)), d.O) > d.r2)
+	  return -1;
+	return 0;
+      }
+      case Kind::box : {
+	const BoxPrim& bx = boxes[pr.idx];
+	if(bx.min <= a && b <= bx.max)
+	  return 1;
+	if(b.x < bx.min.x || b.y < bx.min.y || a.x > bx.max.x || a.y > bx.max.y)
+	  return -1;
+	return 0;
+      }
+      case Kind::segment : {
+	// The capsule around the segment is convex.
+	const SegmentPrim& w = segments[pr.idx];
+	if(Wire::distance2(w.segment, a) < w.r2 && Wire::distance2(w.segment, b) < w.r2
+	   && Wire::distance2(w.segment, {a.x, b.y}) < w.r2 && Wire::distance2(w.segment, {b.x, a.y}) < w.r2)
+	  return 1;
+	Point  c = .5*(a + b);
+	double h = .5*std::sqrt(d2(a, b));
+	if(std::sqrt(Wire::distance2(w.segment, c)) - h > std::sqrt(w.r2))
+	  return -1;
+	return 0;
+      }
+      default :
+	return 0;
+      }
+    }
+
+    /* Calls prim(material) for each compiled primitive containing pos,
+       and opq(area, point) for each opaque one, until one of them
+       returns true. */
+    template<typename PrimFn, typename OpaqueFn>
+    void for_each(const Point& pos, const PrimFn& prim, const OpaqueFn& opq) const {
+      index.visit(pos, [this, &pos, &prim, &opq](unsigned int i) {
+	  const Prim& pr = prims[i];
+	  switch(pr.kind) {
+	  case Kind::disk : {
+	    const DiskPrim& d = disks[pr.idx];
+	    return d2(backward(d.frame, pos), d.O) <= d.r2 && prim(d.material);
+	  }
+	  case Kind::box : {
+	    const BoxPrim& b = boxes[pr.idx];
+	    Point          p = backward(b.frame, pos);
+	    return b.min <= p && p <= b.max && prim(b.material);
+	  }
+	  case Kind::segment : {
+	    const SegmentPrim& w = segments[pr.idx];
+	    return Wire::distance2(w.segment, backward(w.frame, pos)) < w.r2 && prim(w.material);
+	  }
+	  default : {
+	    const OpaquePrim& o = opaques[pr.idx];
+	    return opq(*(o.area), backward(o.frame, pos));
+	  }
+	  }
+	});
+    }
+
+  public:
+
+    CompiledArea() : Area(), root(), frames(), disks(), boxes(), segments(), opaques(),
+		     prims(), prim_boxes(), index() {}
+    virtual ~CompiledArea() {}
+
+    /**
+     * Flattens the area tree. The tree must not be modified
+     * afterwards, compile it again otherwise.
+     */
+    void compile(AreaRef area) {
+      *this = CompiledArea();
+      root  = area;
+      frames.push_back({0, Op::identity, {0,0}});
+      add(area, 0);
+      index.build(prim_boxes);
+    }
+
+    virtual bool in(const Point& pos) const override final {
+      bool res = false;
+      for_each(pos,
+	       [&res](const Material&) {return res = true;},
+	       [&res](const Area& a, const Point& p) {return res = a.in(p);});
+      return res;
+    }
+
+    virtual double mobility(const Point& pos) const override final {
+      double res = 0;
+      for_each(pos,
+	       [&res](const Material& m) {res = std::max(res, m.mobility); return false;},
+	       [&res](const Area& a, const Point& p) {res = std::max(res, a.mobility(p)); return false;});
+      return res;
+    }
+
+    virtual double density(const Point& pos) const override final {
+      double res = 0;
+      for_each(pos,
+	       [&res](const Material& m) {res = std::max(res, m.density); return false;},
+	       [&res](const Area& a, const Point& p) {res = std::max(res, a.density(p)); return false;});
+      return res;
+    }
+
+    virtual double min_d2(const Point& pos) const override final {
+      double res = std::numeric_limits<double>::max();
+      for_each(pos,
+	       [&res](const Material& m) {res = std::min(res, m.min_d2); return false;},
+	       [&res](const Area& a, const Point& p) {res = std::min(res, a.min_d2(p)); return false;});
+      return res;
+    }
+
+    virtual Properties query(const Point& pos) const override final {
+      Properties res;
+      for_each(pos,
+	       [&res](const Material& m) {merge(res, m); return false;},
+	       [&res](const Area& a, const Point& p) {res.merge(a.query(p)); return false;});
+      return res;
+    }
+
+    /**
+     * Tells whether the properties are the same all over the
+     * rectangle [bmin,bmax], in which case they are stored in res.
+     * The test is conservative: it may fail on a uniform rectangle,
+     * for instance near opaque areas.
+     */
+    bool uniform(const Point& bmin, const Point& bmax, Properties& res) const {
+      double scale  = std::max({std::fabs(bmin.x), std::fabs(bmin.y), std::fabs(bmax.x), std::fabs(bmax.y)});
+      Point  margin = Point(1,1)*(elecBVH_MARGIN*(1 + scale));
+      Point  lo     = bmin - margin;
+      Point  hi     = bmax + margin;
+      bool   res_ok = true;
+      res = Properties();
+      index.visit(lo, hi, [this, &lo, &hi, &res, &res_ok](unsigned int i) {
+	  const Prim& pr = prims[i];
+	  Point a, b;
+	  backward(frame_of(pr), lo, hi, a, b);
+	  int c = cover(pr, a, b);
+	  if(c == 0)
+	    return !(res_ok = false);
+	  if(c > 0)
+	    merge(res, material_of(pr));
+	  return false;
+	});
+      return res_ok;
+    }
+
+    virtual double distance(const Point& pos, double bound, Point& g) const override final {
+      double res = bound;
+      Point  b(bound, bound);
+      unsigned int near = 0;
+      g = {0,0};
+      index.visit(pos - b, pos + b, [this, &pos, bound, &res, &g, &near](unsigned int i) {
+	  const Prim&  pr    = prims[i];
+	  unsigned int frame = frame_of(pr);
+	  Point        p     = backward(frame, pos);
+	  Point        gi;
+	  double       d;
+	  switch(pr.kind) {
+	  case Kind::disk : {
+	    const DiskPrim& dk = disks[pr.idx];
+	    d = disk_distance(dk.O, dk.r, p, gi);
+	    break;
+	  }
+	  case Kind::box : {
+	    const BoxPrim& bx = boxes[pr.idx];
+	    d = box_distance(bx.min, bx.max, p, gi);
+	    break;
+	  }
+	  case Kind::segment : {
+	    const SegmentPrim& w = segments[pr.idx];
+	    d = segment_distance(w.segment.A, w.segment.u, w.segment.l, w.r, p, gi);
+	    break;
+	  }
+	  default :
+	    d = opaques[pr.idx].area->distance(p, bound, gi);
+	    break;
+	  }
+	  if(d < bound)
+	    ++near;
+	  if(d < res) {
+	    res = d;
+	    g   = forward_direction(frame, gi);
+	  }
+	  return false;
+	});
+      if(near > 1)
+	g = {0,0};
+      return res;
+    }
+
+    virtual std::pair<Point,Point> bbox() const override final {
+      return root->bbox();
+    }
+
+    virtual double largest_min_d2() const override final {
+      return root->largest_min_d2();
+    }
+  };
+}
@@ -32,8 +32,11 @@ namespace elec {
 
     template<typename Iter>
     void transfer(const Iter& begin, const Iter& end) {
-      for(auto it =  begin ; it != end ; ++it)
-	transfer(*it);
+      for(auto it =  begin ; it != end ; ++it) {
+	Point elec_pos = *it;
+	transfer(elec_pos);
+	*it = elec_pos;
+      }
     }
   };
   
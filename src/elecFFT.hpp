@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <utility>
+
+#include <elecParams.hpp>
+
+/*
+ * Self-contained radix-2 fast Fourier transform, for the particle-mesh
+ * field engine. Sizes must be powers of 2.
+ */
+
+namespace elec {
+  namespace fft {
+
+    using complex = std::complex<double>;
+
+    inline unsigned int next_power_of_2(unsigned int n) {
+      unsigned int res = 1;
+      while(res < n) res <<= 1;
+      return res;
+    }
+
+    /**
+     * In place transform of n values, separated by stride. The inverse
+     * transform is not normalized.
+     */
+    inline void transform(complex* data, unsigned int n, unsigned int stride, bool inverse) {
+      for(unsigned int i = 1, j = 0; i < n; ++i) {
+	unsigned int bit = n >> 1;
+	for(; j & bit; bit >>= 1)
+	  j ^= bit;
+	j ^= bit;
+	if(i < j)
+	  std::swap(data[i*stride], data[j*stride]);
+      }
+
+      for(unsigned int len = 2; len <= n; len <<= 1) {
+	double  angle = (inverse ? 2 : -2)*elecPI/len;
+	complex wlen(std::cos(angle), std::sin(angle));
+	for(unsigned int i = 0; i < n; i += len) {
+	  complex w(1,0);
+	  for(unsigned int k = 0; k < len/2; ++k) {
+	    complex& a = data[(i+k)*stride];
+	    complex& b = data[(i+k+len/2)*stride];
+	    complex  t = b*w;
+	    b  = a-t;
+	    a += t;
+	    w *= wlen;
+	  }
+	}
+      }
+    }
+
+    /**
+     * In place transform of a nx*ny array, stored row by row (x is the
+     * fast index). The inverse transform is normalized.
+     */
+    inline void transform(std::vector<complex>& data, unsigned int nx, unsigned int ny, bool inverse) {
+      for(unsigned int y = 0; y < ny; ++y)
+	transform(data.data() + y*nx, nx, 1, inverse);
+      for(unsigned int x = 0; x < nx; ++x)
+	transform(data.data() + x, ny, nx, inverse);
+      if(inverse) {
+	double coef = 1.0/(nx*ny);
+	for(auto& c : data)
+	  c *= coef;
+      }
+    }
+  }
+}
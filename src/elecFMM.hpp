@@ -0,0 +1,365 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <elecParams.hpp>
+#include <elecPoint.hpp>
+#include <elecParticle.hpp>
+#include <elecField.hpp>
+#include <elecTaylor.hpp>
+
+#define elecFMM_MAX_LEVEL 10
+#define elecFMM_MAX_ORDER 30
+#define elecFMM_BUFFER_SIZE ((elecFMM_MAX_ORDER+1)*(elecFMM_MAX_ORDER+2)/2)
+
+/* Convergence ratio used to deduce the expansion order from the
+   requested error. The worst case between well separated boxes is
+   1/sqrt(2), which is pessimistic: the errors measured against direct
+   summation stay below the request with .5. */
+#define elecFMM_RATIO .5
+
+namespace elec {
+
+  /**
+   * Fast multipole field engine. Space is split into a uniform
+   * hierarchy of square boxes. Multipole moments are gathered upward,
+   * converted into local Taylor expansions through the interaction
+   * lists, and pushed downward. A query point in a leaf box is then
+   * evaluated from the local expansion of that box plus the direct
+   * summation over the 3x3 neighbouring leaves. Leaves are never
+   * thinner than elecMIN_E_RADIUS, so that the softening only occurs
+   * in the direct part.
+   *
+   * The expansion order p is the smallest one such that
+   * elecFMM_RATIO^(p+1) is below the requested relative error.
+   *
+   * In the M2L translation, the binomial coefficients are folded into
+   * the kernel coefficients (scaled by i!j!) and into the moments
+   * (scaled by 1/(i!j!)), so that each local term is a plain dot
+   * product.
+   */
+  class FMM : public Field {
+  private:
+
+    struct Level {
+      unsigned int        side;      // number of boxes along an axis.
+      double              w;         // box width.
+      std::vector<int>    slot;      // box id -> rank in boxes, or -1 if empty.
+      std::vector<unsigned int> boxes;
+      std::vector<double> multipoles;
+      std::vector<double> locals;
+    };
+
+    double                    epsilon;
+    unsigned int              leaf_size;
+    std::vector<double>       fact;
+    unsigned int              order;
+    unsigned int              nb_terms;
+    std::vector<double>       binom;
+    Point                     origin;
+    double                    width;
+    std::vector<Charge>       sorted;
+    std::vector<unsigned int> leaf_begin;
+    std::vector<Level>        levels;
+
+    double C(unsigned int n, unsigned int k) const {return binom[n*(n+1)/2+k];}
+
+    Point center(const Level& lev, unsigned int id) const {
+      return origin + Point(((id % lev.side)+.5)*lev.w, ((id / lev.side)+.5)*lev.w);
+    }
+
+    void m2m(const double* m, const Point& d, double* M) const {
+      double pd[elecFMM_BUFFER_SIZE];
+      taylor::powers(d,order,pd);
+      for(unsigned int n = 0; n <= order; ++n)
+	for(unsigned int k2 = 0; k2 <= n; ++k2) {
+	  unsigned int k1  = n-k2;
+	  double       res = 0;
+	  for(unsigned int j1 = 0; j1 <= k1; ++j1)
+	    for(unsigned int j2 = 0; j2 <= k2; ++j2)
+	      res += C(k1,j1)*C(k2,j2)*m[taylor::index(j1,j2)]*pd[taylor::index(k1-j1,k2-j2)];
+	  M[taylor::index(k1,k2)] += res;
+	}
+    }
+
+    /* a is scaled by i!j! (see scale_kernel). */
+    void m2l(const double* m, const double* a, double* L) const {
+      double mm[elecFMM_BUFFER_SIZE];
+      for(unsigned int k = 0; k <= order; ++k)
+	for(unsigned int k2 = 0; k2 <= k; ++k2)
+	  mm[taylor::index(k-k2,k2)] = m[taylor::index(k-k2,k2)]/(fact[k-k2]*fact[k2]);
+
+      for(unsigned int n = 0; n <= order; ++n)
+	for(unsigned int n2 = 0; n2 <= n; ++n2) {
+	  unsigned int n1  = n-n2;
+	  double       res = 0;
+	  for(unsigned int k = 0; k <= order; ++k) {
+	    const double* ak = a  + taylor::index(n1+k,n2);
+	    const double* mk = mm + taylor::index(k,0);
+	    for(unsigned int k2 = 0; k2 <= k; ++k2)
+	      res += ak[k2]*mk[k2];
+	  }
+	  res /= fact[n1]*fact[n2];
+	  L[taylor::index(n1,n2)] += (n % 2 == 0) ? res : -res;
+	}
+    }
+
+    void scale_kernel(double* a) const {
+      for(unsigned int n = 0; n <= 2*order; ++n)
+	for(unsigned int j = 0; j <= n; ++j)
+	  a[taylor::index(n-j,j)] *= fact[n-j]*fact[j];
+    }
+
+    void l2l(const double* l, const Point& d, double* L) const {
+      double pd[elecFMM_BUFFER_SIZE];
+      taylor::powers(d,order,pd);
+      for(unsigned int n = 0; n <= order; ++n)
+	for(unsigned int n2 = 0; n2 <= n; ++n2) {
+	  unsigned int n1  = n-n2;
+	  double       res = 0;
+	  for(unsigned int m1 = n1; m1 <= order; ++m1)
+	    for(unsigned int m2 = n2; m1+m2 <= order; ++m2)
+	      res += l[taylor::index(m1,m2)]*C(m1,n1)*C(m2,n2)*pd[taylor::index(m1-n1,m2-n2)];
+	  L[taylor::index(n1,n2)] += res;
+	}
+    }
+
+    void l2p(const double* l, const Point& w, Point* e, double* v) const {
+      double pw[elecFMM_BUFFER_SIZE];
+      taylor::powers(w,order,pw);
+      for(unsigned int n = 0; n <= order; ++n)
+	for(unsigned int n2 = 0; n2 <= n; ++n2) {
+	  unsigned int n1 = n-n2;
+	  double       ln = l[taylor::index(n1,n2)];
+	  if(v) *v += ln*pw[taylor::index(n1,n2)];
+	  if(e) {
+	    if(n1 > 0) e->x -= n1*ln*pw[taylor::index(n1-1,n2)];
+	    if(n2 > 0) e->y -= n2*ln*pw[taylor::index(n1,n2-1)];
+	  }
+	}
+    }
+
+    void direct(unsigned int leaf, const Point& at, Point* e, double* v) const {
+      for(unsigned int i = leaf_begin[leaf]; i < leaf_begin[leaf+1]; ++i) {
+	if(e) *e += elec::E(sorted[i],at);
+	if(v) *v += elec::V(sorted[i],at);
+      }
+    }
+
+    /* Used for points which are not in a non empty leaf. */
+    void traverse(unsigned int l, unsigned int id, const Point& at, double* a, Point* e, double* v) const {
+      const Level& lev = levels[l];
+      int s = lev.slot[id];
+      if(s < 0)
+	return;
+      Point  c    = center(lev,id);
+      double r    = lev.w*std::sqrt(.5);
+      double dist = d(c,at);
+      if(dist*elecFMM_RATIO >= r && dist - r >= elecMIN_E_RADIUS) {
+	Point  ee = {0,0};
+	double vv = 0;
+	taylor::coulomb(at - c, order+1, a);
+	taylor::evaluate(a, lev.multipoles.data() + s*nb_terms, order, ee, vv);
+	if(e) *e += ee;
+	if(v) *v += vv;
+      }
+      else if(l+1 == levels.size())
+	direct(id,at,e,v);
+      else {
+	unsigned int ix = id % lev.side;
+	unsigned int iy = id / lev.side;
+	unsigned int side = levels[l+1].side;
+	for(unsigned int k = 0; k < 4; ++k)
+	  traverse(l+1, (2*iy + k/2)*side + 2*ix + k%2, at, a, e, v);
+      }
+    }
+
+    void evaluate(const Point& at, Point* e, double* v) const {
+      if(e) *e = {0,0};
+      if(v) *v = 0;
+      if(levels.size() == 0)
+	return;
+
+      const Level& leaves = levels.back();
+      Point  rel = (at - origin)/leaves.w;
+      if(levels.size() > 2
+	 && rel.x >= 0 && rel.x < leaves.side
+	 && rel.y >= 0 && rel.y < leaves.side) {
+	int ix = (int)(rel.x);
+	int iy = (int)(rel.y);
+	int s  = leaves.slot[iy*leaves.side + ix];
+	if(s >= 0) {
+	  l2p(leaves.locals.data() + s*nb_terms, at - center(leaves, iy*leaves.side + ix), e, v);
+	  for(int y = std::max(iy-1,0); y <= std::min(iy+1,(int)leaves.side-1); ++y)
+	    for(int x = std::max(ix-1,0); x <= std::min(ix+1,(int)leaves.side-1); ++x)
+	      direct(y*leaves.side + x, at, e, v);
+	  return;
+	}
+      }
+      std::vector<double> a(taylor::size(order+1));
+      traverse(0, 0, at, a.data(), e, v);
+    }
+
+  public:
+
+    /**
+     * @param epsilon the requested relative error of the far field.
+     * @param leaf_size the expected number of charges in a leaf box.
+     */
+    FMM(double epsilon, unsigned int leaf_size)
+      : Field(), epsilon(epsilon), leaf_size(leaf_size), fact(),
+	order(1), nb_terms(0), binom(),
+	origin(), width(0), sorted(), leaf_begin(), levels() {
+      while(order < elecFMM_MAX_ORDER && std::pow(elecFMM_RATIO, order+1.0) > epsilon)
+	++order;
+      nb_terms = taylor::size(order);
+      binom    = taylor::binomials(2*order+1);
+      fact.push_back(1);
+      for(unsigned int n = 1; n <= 2*order; ++n)
+	fact.push_back(fact.back()*n);
+    }
+    virtual ~FMM() {}
+
+    /**
+     * The expansion order deduced from the requested error.
+     */
+    unsigned int expansion_order() const {return order;}
+
+    virtual void build(const std::vector<Charge>& charges) override {
+      sorted.clear();
+      levels.clear();
+      leaf_begin.clear();
+      if(charges.size() == 0)
+	return;
+
+      Point min = charges.front().pos;
+      Point max = min;
+      for(auto& c : charges) {
+	min = elec::min(min,c.pos);
+	max = elec::max(max,c.pos);
+      }
+      double half = .5*std::max(max.x-min.x, max.y-min.y);
+      half  += 1e-9*(1+half);
+      origin = (min+max)*.5 - Point(half,half);
+      width  = 2*half;
+
+      unsigned int nb_levels = 1;
+      while(nb_levels <= elecFMM_MAX_LEVEL
+	    && charges.size() > leaf_size*(std::size_t(1) << (2*(nb_levels-1)))
+	    && width/(1 << nb_levels) >= elecMIN_E_RADIUS)
+	++nb_levels;
+      levels.resize(nb_levels);
+      for(unsigned int l = 0; l < nb_levels; ++l) {
+	levels[l].side = 1 << l;
+	levels[l].w    = width/levels[l].side;
+	levels[l].slot.assign(levels[l].side*levels[l].side, -1);
+      }
+
+      // Charges are sorted by leaf.
+      Level& leaves = levels.back();
+      std::vector<unsigned int> leaf_of(charges.size());
+      leaf_begin.assign(leaves.side*leaves.side+1, 0);
+      for(unsigned int i = 0; i < charges.size(); ++i) {
+	Point rel = (charges[i].pos - origin)/leaves.w;
+	unsigned int ix = std::min((unsigned int)(std::max(rel.x,0.)), leaves.side-1);
+	unsigned int iy = std::min((unsigned int)(std::max(rel.y,0.)), leaves.side-1);
+	leaf_of[i] = iy*leaves.side + ix;
+	++leaf_begin[leaf_of[i]+1];
+      }
+      for(unsigned int b = 0; b < leaves.side*leaves.side; ++b)
+	leaf_begin[b+1] += leaf_begin[b];
+      std::vector<unsigned int> pos(leaf_begin.begin(), leaf_begin.end()-1);
+      sorted.resize(charges.size());
+      for(unsigned int i = 0; i < charges.size(); ++i)
+	sorted[pos[leaf_of[i]]++] = charges[i];
+
+      // Upward pass.
+      for(unsigned int b = 0; b < leaves.side*leaves.side; ++b)
+	if(leaf_begin[b] != leaf_begin[b+1]) {
+	  leaves.slot[b] = leaves.boxes.size();
+	  leaves.boxes.push_back(b);
+	}
+      leaves.multipoles.assign(leaves.boxes.size()*nb_terms, 0);
+      for(unsigned int s = 0; s < leaves.boxes.size(); ++s) {
+	unsigned int b = leaves.boxes[s];
+	Point        c = center(leaves,b);
+	for(unsigned int i = leaf_begin[b]; i < leaf_begin[b+1]; ++i)
+	  taylor::add_moments(sorted[i].pos - c, sorted[i].q, order, leaves.multipoles.data() + s*nb_terms);
+      }
+      for(unsigned int l = nb_levels-1; l > 0; --l) {
+	Level& child  = levels[l];
+	Level& parent = levels[l-1];
+	for(auto b : child.boxes) {
+	  unsigned int p = ((b / child.side)/2)*parent.side + (b % child.side)/2;
+	  if(parent.slot[p] < 0) {
+	    parent.slot[p] = parent.boxes.size();
+	    parent.boxes.push_back(p);
+	  }
+	}
+	parent.multipoles.assign(parent.boxes.size()*nb_terms, 0);
+	for(unsigned int s = 0; s < child.boxes.size(); ++s) {
+	  unsigned int b = child.boxes[s];
+	  unsigned int p = ((b / child.side)/2)*parent.side + (b % child.side)/2;
+	  m2m(child.multipoles.data() + s*nb_terms, center(child,b) - center(parent,p),
+	      parent.multipoles.data() + parent.slot[p]*nb_terms);
+	}
+      }
+
+      // Downward pass. The kernel coefficients only depend on the
+      // relative position of the boxes, in [-3,3]^2 box widths.
+      std::vector<double> kernels(49*taylor::size(2*order));
+      for(unsigned int l = 2; l < nb_levels; ++l) {
+	Level& lev    = levels[l];
+	Level& parent = levels[l-1];
+	for(int dy = -3; dy <= 3; ++dy)
+	  for(int dx = -3; dx <= 3; ++dx)
+	    if(std::abs(dx) > 1 || std::abs(dy) > 1) {
+	      double* a = kernels.data() + ((dy+3)*7+dx+3)*taylor::size(2*order);
+	      taylor::coulomb(Point(dx,dy)*lev.w, 2*order, a);
+	      scale_kernel(a);
+	    }
+
+	lev.locals.assign(lev.boxes.size()*nb_terms, 0);
+	for(unsigned int s = 0; s < lev.boxes.size(); ++s) {
+	  unsigned int b  = lev.boxes[s];
+	  int          ix = b % lev.side;
+	  int          iy = b / lev.side;
+	  double*      L  = lev.locals.data() + s*nb_terms;
+	  if(l > 2) {
+	    unsigned int p = (iy/2)*parent.side + ix/2;
+	    l2l(parent.locals.data() + parent.slot[p]*nb_terms, center(lev,b) - center(parent,p), L);
+	  }
+	  int px = ix/2;
+	  int py = iy/2;
+	  for(int y = std::max(2*py-2,0); y <= std::min(2*py+3,(int)lev.side-1); ++y)
+	    for(int x = std::max(2*px-2,0); x <= std::min(2*px+3,(int)lev.side-1); ++x) {
+	      if(std::abs(x-ix) <= 1 && std::abs(y-iy) <= 1)
+		continue;
+	      int src = lev.slot[y*lev.side + x];
+	      if(src >= 0)
+		m2l(lev.multipoles.data() + src*nb_terms,
+		    kernels.data() + ((iy-y+3)*7+ix-x+3)*taylor::size(2*order), L);
+	    }
+	}
+      }
+    }
+
+    virtual Point E(const Point& at) const override {
+      Point e;
+      evaluate(at,&e,nullptr);
+      return e;
+    }
+
+    virtual double V(const Point& at) const override {
+      double v;
+      evaluate(at,nullptr,&v);
+      return v;
+    }
+  };
+
+  inline FieldRef fmm(double epsilon, unsigned int leaf_size = 16) {
+    return FieldRef(static_cast<Field*>(new FMM(epsilon,leaf_size)));
+  }
+}
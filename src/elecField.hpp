@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include <elecParams.hpp>
+#include <elecPoint.hpp>
+#include <elecParticle.hpp>
+
+namespace elec {
+
+  /**
+   * A point charge, expressed in elementary charges (protons are +1,
+   * electrons are -1).
+   */
+  struct Charge {
+    Point  pos;
+    double q;
+  };
+
+  inline Point E(const Charge& c, const Point& at) {
+    return c.q*E(c.pos,at);
+  }
+
+  inline double V(const Charge& c, const Point& at) {
+    return c.q*V(c.pos,at);
+  }
+
+  /**
+   * A field engine approximates the field and the potential induced
+   * by a set of charges. It is built once from the charges, and then
+   * queried at any point. The elecMIN_E_RADIUS softening of the
+   * direct summation has to be preserved by the engines.
+   *
+   * Some engines can also follow the motion of a single charge
+   * without being built again (see update).
+   */
+  class Field {
+  public:
+
+    Field() {}
+    virtual ~Field() {}
+
+    virtual void   build(const std::vector<Charge>& charges) = 0;
+    virtual Point  E    (const Point& at) const              = 0;
+    virtual double V    (const Point& at) const              = 0;
+
+    /**
+     * Sets out[i] to the field (resp. potential) at at[i], for i < n.
+     */
+    virtual void E_batch(const Point* at, Point* out, std::size_t n) const {
+      for(std::size_t i = 0; i < n; ++i) out[i] = E(at[i]);
+    }
+
+    virtual void V_batch(const Point* at, double* out, std::size_t n) const {
+      for(std::size_t i = 0; i < n; ++i) out[i] = V(at[i]);
+    }
+
+    /**
+     * Tells whether update is supported.
+     */
+    virtual bool incremental() const {return false;}
+
+    /**
+     * Moves the charge of rank idx (in the vector given to build) from
+     * its current position to the position to. It returns false if
+     * the engine has to be built again to stay accurate.
+     */
+    virtual bool update(std::size_t, const Point&) {return false;}
+  };
+
+  using FieldRef = std::shared_ptr<Field>;
+
+  /**
+   * Error of an engine with respect to direct summation. The rms
+   * errors are relative to the rms of the exact values, the max
+   * errors are the largest absolute errors relative to that same rms.
+   */
+  struct FieldError {
+    double E_rms = 0;
+    double E_max = 0;
+    double V_rms = 0;
+    double V_max = 0;
+  };
+
+  inline std::ostream& operator<<(std::ostream& os,
+				  const FieldError& err) {
+    os << "E: rms " << err.E_rms << ", max " << err.E_max
+       << " | V: rms " << err.V_rms << ", max " << err.V_max;
+    return os;
+  }
+
+  /**
+   * Compares the engine (built from the charges) with the direct
+   * summation over these charges, at the given points.
+   */
+  inline FieldError error(const Field& field, const std::vector<Charge>& charges, const std::vector<Point>& at) {
+    FieldError res;
+    double ref_E = 0, ref_V = 0, dE_max = 0, dV_max = 0;
+    for(auto& p : at) {
+      Point  e  = E(charges.begin(), charges.end(), p);
+      double v  = V(charges.begin(), charges.end(), p);
+      double dE = d2(field.E(p),e);
+      double dV = field.V(p)-v; dV *= dV;
+      res.E_rms += dE;
+      res.V_rms += dV;
+      ref_E     += e*e;
+      ref_V     += v*v;
+      dE_max     = std::max(dE_max,dE);
+      dV_max     = std::max(dV_max,dV);
+    }
+    if(ref_E > 0) {
+      res.E_rms = std::sqrt(res.E_rms/ref_E);
+      res.E_max = std::sqrt(dE_max*at.size()/ref_E);
+    }
+    if(ref_V > 0) {
+      res.V_rms = std::sqrt(res.V_rms/ref_V);
+      res.V_max = std::sqrt(dV_max*at.size()/ref_V);
+    }
+    return res;
+  }
+}
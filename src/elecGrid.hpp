@@ -0,0 +1,229 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+#include <elecParams.hpp>
+#include <elecPoint.hpp>
+#include <elecParticle.hpp>
+#include <elecKernels.hpp>
+#include <elecField.hpp>
+
+#include <ccmpl.hpp>
+
+namespace elec {
+
+  /**
+   * Field engine for charges that do not move (the protons). The field
+   * and the potential are computed once, exactly, at the nodes of a
+   * regular grid covering the given limits, and interpolated at query
+   * time (bilinear or bicubic Catmull-Rom). Interpolation cannot
+   * render the field of the charges close to the query point, so the
+   * charges lying in the cells around it are corrected exactly: their
+   * interpolated contribution is removed and their actual one is
+   * added. Queries outside the grid are summed directly.
+   *
+   * The relative error is mainly set by near_cells, since the
+   * uncorrected charges are at least near_cells cells away from the
+   * query. The resolution then trades the grid size against the
+   * number of charges corrected per query. Use
+   * World::proton_field_error to choose them.
+   */
+  class GridField : public Field {
+  private:
+
+    Point                     min, max;
+    unsigned int              near_cells;
+    bool                      bicubic;
+    unsigned int              nx, ny;
+    Point                     h;
+    std::vector<Point>        node_E;
+    std::vector<double>       node_V;
+    std::vector<Charge>       sorted;     // charges, sorted by grid cell.
+    std::vector<unsigned int> cell_begin;
+
+    // Charges of equal value, as arrays, for the kernels.
+    struct Group {
+      double              q;
+      std::vector<double> xs, ys;
+    };
+    std::vector<Group> groups;
+
+    Point node(int i, int j) const {
+      return {min.x + i*h.x, min.y + j*h.y};
+    }
+
+    Point exact_E(const Point& at) const {
+      Point e = {0,0};
+      for(auto& g : groups)
+	e += g.q*kernel::E(g.xs.data(), g.ys.data(), g.xs.size(), at);
+      return e;
+    }
+
+    double exact_V(const Point& at) const {
+      double v = 0;
+      for(auto& g : groups)
+	v += g.q*kernel::V(g.xs.data(), g.ys.data(), g.xs.size(), at);
+      return v;
+    }
+
+    /* Interpolation stencil: nodes first_i+k, first_j+l, with weights
+       wx[k]*wy[l]. Returns the stencil width, 0 if at is out of the
+       grid. */
+    unsigned int stencil(const Point& at, int& first_i, int& first_j, double* wx, double* wy) const {
+      double u = (at.x - min.x)/h.x;
+      double v = (at.y - min.y)/h.y;
+      if(!(u >= 0 && v >= 0 && u <= nx-1 && v <= ny-1))
+	return 0;
+      int i = std::min((int)u, (int)nx-2);
+      int j = std::min((int)v, (int)ny-2);
+      u -= i;
+      v -= j;
+      if(!bicubic || i < 1 || j < 1 || i+2 >= (int)nx || j+2 >= (int)ny) {
+	// Bilinear, also used in the border cells.
+	first_i = i;
+	first_j = j;
+	wx[0] = 1-u; wx[1] = u;
+	wy[0] = 1-v; wy[1] = v;
+	return 2;
+      }
+      first_i = i-1;
+      first_j = j-1;
+      catmull_rom(u, wx);
+      catmull_rom(v, wy);
+      return 4;
+    }
+
+    /* Weights of the nodes at -1,0,1,2 for t in [0,1]. */
+    static void catmull_rom(double t, double* w) {
+      double t2 = t*t, t3 = t2*t;
+      w[0] = .5*(-t3 + 2*t2 - t);
+      w[1] = .5*(3*t3 - 5*t2 + 2);
+      w[2] = .5*(-3*t3 + 4*t2 + t);
+      w[3] = .5*(t3 - t2);
+    }
+
+    template<typename Fn>
+    void for_near_charges(const Point& at, const Fn& fn) const {
+      int ci = (int)std::floor((at.x - min.x)/h.x);
+      int cj = (int)std::floor((at.y - min.y)/h.y);
+      int nc = near_cells;
+      for(int j = std::max(cj-nc,0); j <= std::min(cj+nc,(int)ny-2); ++j) {
+	unsigned int row = j*(nx-1);
+	unsigned int b   = cell_begin[row + std::max(ci-nc,0)];
+	unsigned int e   = cell_begin[row + std::min(ci+nc,(int)nx-2) + 1];
+	for(unsigned int k = b; k < e; ++k)
+	  fn(sorted[k]);
+      }
+    }
+
+  public:
+
+    /**
+     * @param limits the area covered by the grid.
+     * @param resolution the size of a grid cell.
+     * @param near_cells the charges in the cells at most at this
+     * cell distance from the query are corrected exactly.
+     * @param bicubic bicubic rather than bilinear interpolation.
+     */
+    GridField(const ccmpl::chart::Limits2d& limits, double resolution,
+	      unsigned int near_cells, bool bicubic)
+      : Field(),
+	min(limits.xmin, limits.ymin), max(limits.xmax, limits.ymax),
+	near_cells(near_cells), bicubic(bicubic),
+	nx(std::max(2u, (unsigned int)(std::ceil((limits.xmax-limits.xmin)/resolution))+1)),
+	ny(std::max(2u, (unsigned int)(std::ceil((limits.ymax-limits.ymin)/resolution))+1)),
+	h((limits.xmax-limits.xmin)/(nx-1), (limits.ymax-limits.ymin)/(ny-1)),
+	node_E(), node_V(), sorted(), cell_begin(), groups() {}
+    virtual ~GridField() {}
+
+    virtual void build(const std::vector<Charge>& charges) override {
+      std::map<double, unsigned int> rank;
+      groups.clear();
+      for(auto& c : charges) {
+	auto it = rank.find(c.q);
+	if(it == rank.end()) {
+	  it = rank.insert({c.q, (unsigned int)(groups.size())}).first;
+	  groups.push_back({c.q, {}, {}});
+	}
+	groups[it->second].xs.push_back(c.pos.x);
+	groups[it->second].ys.push_back(c.pos.y);
+      }
+
+      unsigned int nb_cells = (nx-1)*(ny-1);
+      std::vector<Charge> inside;
+      std::vector<unsigned int> cell_of;
+      cell_begin.assign(nb_cells+1, 0);
+      for(auto& c : charges) {
+	int i = (int)std::floor((c.pos.x - min.x)/h.x);
+	int j = (int)std::floor((c.pos.y - min.y)/h.y);
+	if(i < 0 || j < 0 || i >= (int)nx-1 || j >= (int)ny-1)
+	  continue; // far from every grid cell, interpolation is fine.
+	inside.push_back(c);
+	cell_of.push_back(j*(nx-1)+i);
+	++cell_begin[cell_of.back()+1];
+      }
+      for(unsigned int c = 0; c < nb_cells; ++c)
+	cell_begin[c+1] += cell_begin[c];
+      std::vector<unsigned int> pos(cell_begin.begin(), cell_begin.end()-1);
+      sorted.resize(inside.size());
+      for(unsigned int k = 0; k < inside.size(); ++k)
+	sorted[pos[cell_of[k]]++] = inside[k];
+
+      node_E.resize(nx*ny);
+      node_V.resize(nx*ny);
+      for(unsigned int j = 0; j < ny; ++j)
+	for(unsigned int i = 0; i < nx; ++i) {
+	  node_E[j*nx+i] = exact_E(node(i,j));
+	  node_V[j*nx+i] = exact_V(node(i,j));
+	}
+    }
+
+    virtual Point E(const Point& at) const override {
+      int fi, fj;
+      double wx[4], wy[4];
+      unsigned int w = stencil(at,fi,fj,wx,wy);
+      if(w == 0)
+	return exact_E(at);
+
+      Point e = {0,0};
+      for(unsigned int l = 0; l < w; ++l)
+	for(unsigned int k = 0; k < w; ++k)
+	  e += (wx[k]*wy[l])*node_E[(fj+l)*nx + fi+k];
+      for_near_charges(at, [&](const Charge& c) {
+	  e += elec::E(c,at);
+	  for(unsigned int l = 0; l < w; ++l)
+	    for(unsigned int k = 0; k < w; ++k)
+	      e -= (wx[k]*wy[l])*elec::E(c,this->node(fi+k,fj+l));
+	});
+      return e;
+    }
+
+    virtual double V(const Point& at) const override {
+      int fi, fj;
+      double wx[4], wy[4];
+      unsigned int w = stencil(at,fi,fj,wx,wy);
+      if(w == 0)
+	return exact_V(at);
+
+      double v = 0;
+      for(unsigned int l = 0; l < w; ++l)
+	for(unsigned int k = 0; k < w; ++k)
+	  v += (wx[k]*wy[l])*node_V[(fj+l)*nx + fi+k];
+      for_near_charges(at, [&](const Charge& c) {
+	  v += elec::V(c,at);
+	  for(unsigned int l = 0; l < w; ++l)
+	    for(unsigned int k = 0; k < w; ++k)
+	      v -= (wx[k]*wy[l])*elec::V(c,this->node(fi+k,fj+l));
+	});
+      return v;
+    }
+  };
+
+  inline FieldRef grid(const ccmpl::chart::Limits2d& limits, double resolution,
+		       unsigned int near_cells = 4, bool bicubic = true) {
+    return FieldRef(static_cast<Field*>(new GridField(limits,resolution,near_cells,bicubic)));
+  }
+}
@@ -0,0 +1,462 @@
+#pragma once
+
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <tuple>
+#include <limits>
+
+#include <elecParams.hpp>
+#include <elecPoint.hpp>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Number of sources per tile in the batched kernels. */
+#define elecKERNEL_TILE 1024
+
+/*
+ * Direct summation kernels over particles stored as separate x and y
+ * arrays. They compute the same values as summing elec::E and elec::V
+ * over each particle, i.e. (at-p)/r^3 and 1/r, but the cutoff at
+ * elecMIN_E_RADIUS is a mask rather than a branch and the unit vector
+ * is not computed: one square root and one division per pair.
+ *
+ * The coordinates are either double or float, the float kernels
+ * processing twice as many particles per instruction. Other types use
+ * a scalar loop. 256 bits registers are used when compiled with AVX
+ * enabled (e.g. -mavx2 or -march=native), SSE2 otherwise.
+ *
+ * The batched versions accumulate the sums at several query points,
+ * going through the sources by tiles of elecKERNEL_TILE so that a tile
+ * stays in L1 cache while all the query points are processed.
+ *
+ * The closest kernels search the nearest of a few particles, for
+ * several query points at once (see World::move).
+ */
+
+namespace elec {
+  namespace kernel {
+
+    template<typename Real>
+    basic_point<Real> E(const Real* xs, const Real* ys, std::size_t n, const basic_point<Real>& at) {
+      const Real min_r2 = Real(elecMIN_E_RADIUS*elecMIN_E_RADIUS);
+      Real ex = 0, ey = 0;
+      for(std::size_t i = 0; i < n; ++i) {
+	Real dx = at.x - xs[i];
+	Real dy = at.y - ys[i];
+	Real r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2) {
+	  Real inv = 1/(r2*std::sqrt(r2));
+	  ex += dx*inv;
+	  ey += dy*inv;
+	}
+      }
+      return {ex,ey};
+    }
+
+    template<typename Real>
+    Real V(const Real* xs, const Real* ys, std::size_t n, const basic_point<Real>& at) {
+      const Real min_r2 = Real(elecMIN_E_RADIUS*elecMIN_E_RADIUS);
+      Real v = 0;
+      for(std::size_t i = 0; i < n; ++i) {
+	Real dx = at.x - xs[i];
+	Real dy = at.y - ys[i];
+	Real r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2)
+	  v += 1/std::sqrt(r2);
+      }
+      return v;
+    }
+
+    inline Point E(const double* xs, const double* ys, std::size_t n, const Point& at) {
+      const double min_r2 = elecMIN_E_RADIUS*elecMIN_E_RADIUS;
+      double ex = 0, ey = 0;
+      std::size_t i = 0;
+
+#if defined(__AVX__)
+      {
+	__m256d ax = _mm256_set1_pd(at.x), ay = _mm256_set1_pd(at.y);
+	__m256d m2 = _mm256_set1_pd(min_r2), one = _mm256_set1_pd(1);
+	__m256d sx = _mm256_setzero_pd(), sy = _mm256_setzero_pd();
+	for(; i + 4 <= n; i += 4) {
+	  __m256d dx   = _mm256_sub_pd(ax, _mm256_loadu_pd(xs+i));
+	  __m256d dy   = _mm256_sub_pd(ay, _mm256_loadu_pd(ys+i));
+	  __m256d r2   = _mm256_add_pd(_mm256_mul_pd(dx,dx), _mm256_mul_pd(dy,dy));
+	  __m256d keep = _mm256_cmp_pd(r2, m2, _CMP_GE_OQ);
+	  __m256d inv  = _mm256_and_pd(keep, _mm256_div_pd(one, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2))));
+	  sx = _mm256_add_pd(sx, _mm256_mul_pd(dx,inv));
+	  sy = _mm256_add_pd(sy, _mm256_mul_pd(dy,inv));
+	}
+	double bx[4], by[4];
+	_mm256_storeu_pd(bx,sx);
+	_mm256_storeu_pd(by,sy);
+	ex += (bx[0]+bx[1]) + (bx[2]+bx[3]);
+	ey += (by[0]+by[1]) + (by[2]+by[3]);
+      }
+#elif defined(__SSE2__)
+      {
+	__m128d ax = _mm_set1_pd(at.x), ay = _mm_set1_pd(at.y);
+	__m128d m2 = _mm_set1_pd(min_r2), one = _mm_set1_pd(1);
+	__m128d sx = _mm_setzero_pd(), sy = _mm_setzero_pd();
+	for(; i + 2 <= n; i += 2) {
+	  __m128d dx   = _mm_sub_pd(ax, _mm_loadu_pd(xs+i));
+	  __m128d dy   = _mm_sub_pd(ay, _mm_loadu_pd(ys+i));
+	  __m128d r2   = _mm_add_pd(_mm_mul_pd(dx,dx), _mm_mul_pd(dy,dy));
+	  __m128d keep = _mm_cmpge_pd(r2, m2);
+	  __m128d inv  = _mm_and_pd(keep, _mm_div_pd(one, _mm_mul_pd(r2, _mm_sqrt_pd(r2))));
+	  sx = _mm_add_pd(sx, _mm_mul_pd(dx,inv));
+	  sy = _mm_add_pd(sy, _mm_mul_pd(dy,inv));
+	}
+	double bx[2], by[2];
+	_mm_storeu_pd(bx,sx);
+	_mm_storeu_pd(by,sy);
+	ex += bx[0]+bx[1];
+	ey += by[0]+by[1];
+      }
+#endif
+
+      for(; i < n; ++i) {
+	double dx = at.x - xs[i];
+	double dy = at.y - ys[i];
+	double r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2) {
+	  double inv = 1/(r2*std::sqrt(r2));
+	  ex += dx*inv;
+	  ey += dy*inv;
+	}
+      }
+      return {ex,ey};
+    }
+
+    inline double V(const double* xs, const double* ys, std::size_t n, const Point& at) {
+      const double min_r2 = elecMIN_E_RADIUS*elecMIN_E_RADIUS;
+      double v = 0;
+      std::size_t i = 0;
+
+#if defined(__AVX__)
+      {
+	__m256d ax = _mm256_set1_pd(at.x), ay = _mm256_set1_pd(at.y);
+	__m256d m2 = _mm256_set1_pd(min_r2), one = _mm256_set1_pd(1);
+	__m256d sv = _mm256_setzero_pd();
+	for(; i + 4 <= n; i += 4) {
+	  __m256d dx   = _mm256_sub_pd(ax, _mm256_loadu_pd(xs+i));
+	  __m256d dy   = _mm256_sub_pd(ay, _mm256_loadu_pd(ys+i));
+	  __m256d r2   = _mm256_add_pd(_mm256_mul_pd(dx,dx), _mm256_mul_pd(dy,dy));
+	  __m256d keep = _mm256_cmp_pd(r2, m2, _CMP_GE_OQ);
+	  sv = _mm256_add_pd(sv, _mm256_and_pd(keep, _mm256_div_pd(one, _mm256_sqrt_pd(r2))));
+	}
+	double bv[4];
+	_mm256_storeu_pd(bv,sv);
+	v += (bv[0]+bv[1]) + (bv[2]+bv[3]);
+      }
+#elif defined(__SSE2__)
+      {
+	__m128d ax = _mm_set1_pd(at.x), ay = _mm_set1_pd(at.y);
+	__m128d m2 = _mm_set1_pd(min_r2), one = _mm_set1_pd(1);
+	__m128d sv = _mm_setzero_pd();
+	for(; i + 2 <= n; i += 2) {
+	  __m128d dx   = _mm_sub_pd(ax, _mm_loadu_pd(xs+i));
+	  __m128d dy   = _mm_sub_pd(ay, _mm_loadu_pd(ys+i));
+	  __m128d r2   = _mm_add_pd(_mm_mul_pd(dx,dx), _mm_mul_pd(dy,dy));
+	  __m128d keep = _mm_cmpge_pd(r2, m2);
+	  sv = _mm_add_pd(sv, _mm_and_pd(keep, _mm_div_pd(one, _mm_sqrt_pd(r2))));
+	}
+	double bv[2];
+	_mm_storeu_pd(bv,sv);
+	v += bv[0]+bv[1];
+      }
+#endif
+
+      for(; i < n; ++i) {
+	double dx = at.x - xs[i];
+	double dy = at.y - ys[i];
+	double r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2)
+	  v += 1/std::sqrt(r2);
+      }
+      return v;
+    }
+
+    inline basic_point<float> E(const float* xs, const float* ys, std::size_t n, const basic_point<float>& at) {
+      const float min_r2 = float(elecMIN_E_RADIUS*elecMIN_E_RADIUS);
+      float ex = 0, ey = 0;
+      std::size_t i = 0;
+
+#if defined(__AVX__)
+      {
+	__m256 ax = _mm256_set1_ps(at.x), ay = _mm256_set1_ps(at.y);
+	__m256 m2 = _mm256_set1_ps(min_r2), one = _mm256_set1_ps(1);
+	__m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps();
+	for(; i + 8 <= n; i += 8) {
+	  __m256 dx   = _mm256_sub_ps(ax, _mm256_loadu_ps(xs+i));
+	  __m256 dy   = _mm256_sub_ps(ay, _mm256_loadu_ps(ys+i));
+	  __m256 r2   = _mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy));
+	  __m256 keep = _mm256_cmp_ps(r2, m2, _CMP_GE_OQ);
+	  __m256 inv  = _mm256_and_ps(keep, _mm256_div_ps(one, _mm256_mul_ps(r2, _mm256_sqrt_ps(r2))));
+	  sx = _mm256_add_ps(sx, _mm256_mul_ps(dx,inv));
+	  sy = _mm256_add_ps(sy, _mm256_mul_ps(dy,inv));
+	}
+	float bx[8], by[8];
+	_mm256_storeu_ps(bx,sx);
+	_mm256_storeu_ps(by,sy);
+	ex += ((bx[0]+bx[1]) + (bx[2]+bx[3])) + ((bx[4]+bx[5]) + (bx[6]+bx[7]));
+	ey += ((by[0]+by[1]) + (by[2]+by[3])) + ((by[4]+by[5]) + (by[6]+by[7]));
+      }
+#elif defined(__SSE2__)
+      {
+	__m128 ax = _mm_set1_ps(at.x), ay = _mm_set1_ps(at.y);
+	__m128 m2 = _mm_set1_ps(min_r2), one = _mm_set1_ps(1);
+	__m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps();
+	for(; i + 4 <= n; i += 4) {
+	  __m128 dx   = _mm_sub_ps(ax, _mm_loadu_ps(xs+i));
+	  __m128 dy   = _mm_sub_ps(ay, _mm_loadu_ps(ys+i));
+	  __m128 r2   = _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy));
+	  __m128 keep = _mm_cmpge_ps(r2, m2);
+	  __m128 inv  = _mm_and_ps(keep, _mm_div_ps(one, _mm_mul_ps(r2, _mm_sqrt_ps(r2))));
+	  sx = _mm_add_ps(sx, _mm_mul_ps(dx,inv));
+	  sy = _mm_add_ps(sy, _mm_mul_ps(dy,inv));
+	}
+	float bx[4], by[4];
+	_mm_storeu_ps(bx,sx);
+	_mm_storeu_ps(by,sy);
+	ex += (bx[0]+bx[1]) + (bx[2]+bx[3]);
+	ey += (by[0]+by[1]) + (by[2]+by[3]);
+      }
+#endif
+
+      for(; i < n; ++i) {
+	float dx = at.x - xs[i];
+	float dy = at.y - ys[i];
+	float r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2) {
+	  float inv = 1/(r2*std::sqrt(r2));
+	  ex += dx*inv;
+	  ey += dy*inv;
+	}
+      }
+      return {ex,ey};
+    }
+
+    inline float V(const float* xs, const float* ys, std::size_t n, const basic_point<float>& at) {
+      const float min_r2 = float(elecMIN_E_RADIUS*elecMIN_E_RADIUS);
+      float v = 0;
+      std::size_t i = 0;
+
+#if defined(__AVX__)
+      {
+	__m256 ax = _mm256_set1_ps(at.x), ay = _mm256_set1_ps(at.y);
+	__m256 m2 = _mm256_set1_ps(min_r2), one = _mm256_set1_ps(1);
+	__m256 sv = _mm256_setzero_ps();
+	for(; i + 8 <= n; i += 8) {
+	  __m256 dx   = _mm256_sub_ps(ax, _mm256_loadu_ps(xs+i));
+	  __m256 dy   = _mm256_sub_ps(ay, _mm256_loadu_ps(ys+i));
+	  __m256 r2   = _mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy));
+	  __m256 keep = _mm256_cmp_ps(r2, m2, _CMP_GE_OQ);
+	  sv = _mm256_add_ps(sv, _mm256_and_ps(keep, _mm256_div_ps(one, _mm256_sqrt_ps(r2))));
+	}
+	float bv[8];
+	_mm256_storeu_ps(bv,sv);
+	v += ((bv[0]+bv[1]) + (bv[2]+bv[3])) + ((bv[4]+bv[5]) + (bv[6]+bv[7]));
+      }
+#elif defined(__SSE2__)
+      {
+	__m128 ax = _mm_set1_ps(at.x), ay = _mm_set1_ps(at.y);
+	__m128 m2 = _mm_set1_ps(min_r2), one = _mm_set1_ps(1);
+	__m128 sv = _mm_setzero_ps();
+	for(; i + 4 <= n; i += 4) {
+	  __m128 dx   = _mm_sub_ps(ax, _mm_loadu_ps(xs+i));
+	  __m128 dy   = _mm_sub_ps(ay, _mm_loadu_ps(ys+i));
+	  __m128 r2   = _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy));
+	  __m128 keep = _mm_cmpge_ps(r2, m2);
+	  sv = _mm_add_ps(sv, _mm_and_ps(keep, _mm_div_ps(one, _mm_sqrt_ps(r2))));
+	}
+	float bv[4];
+	_mm_storeu_ps(bv,sv);
+	v += (bv[0]+bv[1]) + (bv[2]+bv[3]);
+      }
+#endif
+
+      for(; i < n; ++i) {
+	float dx = at.x - xs[i];
+	float dy = at.y - ys[i];
+	float r2 = dx*dx + dy*dy;
+	if(r2 >= min_r2)
+	  v += 1/std::sqrt(r2);
+      }
+      return v;
+    }
+
+    /**
+     * Adds the field of the sources at at[j] to out[j], for j < m.
+     */
+    template<typename Real>
+    void E_batch(const Real* xs, const Real* ys, std::size_t n,
+		 const basic_point<Real>* at, basic_point<Real>* out, std::size_t m) {
+      for(std::size_t b = 0; b < n; b += elecKERNEL_TILE) {
+	std::size_t len = std::min<std::size_t>(elecKERNEL_TILE, n-b);
+	for(std::size_t j = 0; j < m; ++j)
+	  out[j] += E(xs+b, ys+b, len, at[j]);
+      }
+    }
+
+    /**
+     * Adds the potential of the sources at at[j] to out[j], for j < m.
+     */
+    template<typename Real>
+    void V_batch(const Real* xs, const Real* ys, std::size_t n,
+		 const basic_point<Real>* at, Real* out, std::size_t m) {
+      for(std::size_t b = 0; b < n; b += elecKERNEL_TILE) {
+	std::size_t len = std::min<std::size_t>(elecKERNEL_TILE, n-b);
+	for(std::size_t j = 0; j < m; ++j)
+	  out[j] += V(xs+b, ys+b, len, at[j]);
+      }
+    }
+    /**
+     * The index of the particle closest to at, and its squared
+     * distance. The first one is returned in case of ties, n if there
+     * is no particle.
+     */
+    inline std::pair<std::size_t,double> closest(const double* xs, const double* ys, std::size_t n, const Point& at) {
+      std::pair<std::size_t,double> res = {n, std::numeric_limits<double>::max()};
+      std::size_t i = 0;
+
+#if defined(__AVX__)
+      if(n >= 4) {
+	__m256d ax   = _mm256_set1_pd(at.x), ay = _mm256_set1_pd(at.y);
+	__m256d best = _mm256_set1_pd(res.second);
+	__m256d bidx = _mm256_set1_pd(0);
+	__m256d idx  = _mm256_set_pd(3,2,1,0), four = _mm256_set1_pd(4);
+	for(; i + 4 <= n; i += 4) {
+	  __m256d dx   = _mm256_sub_pd(ax, _mm256_loadu_pd(xs+i));
+	  __m256d dy   = _mm256_sub_pd(ay, _mm256_loadu_pd(ys+i));
+	  __m256d r2   = _mm256_add_pd(_mm256_mul_pd(dx,dx), _mm256_mul_pd(dy,dy));
+	  __m256d less = _mm256_cmp_pd(r2, best, _CMP_LT_OQ);
+	  best = _mm256_blendv_pd(best, r2,  less);
+	  bidx = _mm256_blendv_pd(bidx, idx, less);
+	  idx  = _mm256_add_pd(idx, four);
+	}
+	double bd[4], bi[4];
+	_mm256_storeu_pd(bd,best);
+	_mm256_storeu_pd(bi,bidx);
+	for(unsigned int k = 0; k < 4; ++k)
+	  if(bd[k] < res.second || (bd[k] == res.second && bi[k] < res.first))
+	    res = {(std::size_t)(bi[k]), bd[k]};
+      }
+#elif defined(__SSE2__)
+      if(n >= 2) {
+	__m128d ax   = _mm_set1_pd(at.x), ay = _mm_set1_pd(at.y);
+	__m128d best = _mm_set1_pd(res.second);
+	__m128d bidx = _mm_set1_pd(0);
+	__m128d idx  = _mm_set_pd(1,0), two = _mm_set1_pd(2);
+	for(; i + 2 <= n; i += 2) {
+	  __m128d dx   = _mm_sub_pd(ax, _mm_loadu_pd(xs+i));
+	  __m128d dy   = _mm_sub_pd(ay, _mm_loadu_pd(ys+i));
+	  __m128d r2   = _mm_add_pd(_mm_mul_pd(dx,dx), _mm_mul_pd(dy,dy));
+	  __m128d less = _mm_cmplt_pd(r2, best);
+	  best = _mm_or_pd(_mm_and_pd(less, r2),  _mm_andnot_pd(less, best));
+	  bidx = _mm_or_pd(_mm_and_pd(less, idx), _mm_andnot_pd(less, bidx));
+	  idx  = _mm_add_pd(idx, two);
+	}
+	double bd[2], bi[2];
+	_mm_storeu_pd(bd,best);
+	_mm_storeu_pd(bi,bidx);
+	for(unsigned int k = 0; k < 2; ++k)
+	  if(bd[k] < res.second || (bd[k] == res.second && bi[k] < res.first))
+	    res = {(std::size_t)(bi[k]), bd[k]};
+      }
+#endif
+
+      for(; i < n; ++i) {
+	double dx = at.x - xs[i];
+	double dy = at.y - ys[i];
+	double r2 = dx*dx + dy*dy;
+	if(r2 < res.second)
+	  res = {i, r2};
+      }
+      return res;
+    }
+
+    /**
+     * closest for the m points at, the results being stored in idx and d2.
+     * The points are handled a SIMD register at a time, each particle
+     * being broadcast against them; the ties are resolved as closest
+     * does, to the first particle.
+     */
+    inline void closest_batch(const double* xs, const double* ys, std::size_t n,
+			      const Point* at, std::size_t* idx, double* d2, std::size_t m) {
+      std::size_t j = 0;
+
+#if defined(__AVX__)
+      if(n > 0)
+	for(; j + 8 <= m; j += 8) {
+	  __m256d ax0   = _mm256_set_pd(at[j+3].x, at[j+2].x, at[j+1].x, at[j].x);
+	  __m256d ay0   = _mm256_set_pd(at[j+3].y, at[j+2].y, at[j+1].y, at[j].y);
+	  __m256d ax1   = _mm256_set_pd(at[j+7].x, at[j+6].x, at[j+5].x, at[j+4].x);
+	  __m256d ay1   = _mm256_set_pd(at[j+7].y, at[j+6].y, at[j+5].y, at[j+4].y);
+	  __m256d best0 = _mm256_set1_pd(std::numeric_limits<double>::max()), best1 = best0;
+	  __m256d bidx0 = _mm256_set1_pd(n), bidx1 = bidx0;
+	  __m256d i_pd  = _mm256_setzero_pd(), one = _mm256_set1_pd(1);
+	  for(std::size_t i = 0; i < n; ++i) {
+	    __m256d x     = _mm256_broadcast_sd(xs+i);
+	    __m256d y     = _mm256_broadcast_sd(ys+i);
+	    __m256d dx0   = _mm256_sub_pd(ax0, x), dy0 = _mm256_sub_pd(ay0, y);
+	    __m256d dx1   = _mm256_sub_pd(ax1, x), dy1 = _mm256_sub_pd(ay1, y);
+	    __m256d r20   = _mm256_add_pd(_mm256_mul_pd(dx0,dx0), _mm256_mul_pd(dy0,dy0));
+	    __m256d r21   = _mm256_add_pd(_mm256_mul_pd(dx1,dx1), _mm256_mul_pd(dy1,dy1));
+	    __m256d less0 = _mm256_cmp_pd(r20, best0, _CMP_LT_OQ);
+	    __m256d less1 = _mm256_cmp_pd(r21, best1, _CMP_LT_OQ);
+	    best0 = _mm256_min_pd(r20, best0);
+	    best1 = _mm256_min_pd(r21, best1);
+	    bidx0 = _mm256_blendv_pd(bidx0, i_pd, less0);
+	    bidx1 = _mm256_blendv_pd(bidx1, i_pd, less1);
+	    i_pd  = _mm256_add_pd(i_pd, one);
+	  }
+	  double bi[8];
+	  _mm256_storeu_pd(d2+j,   best0);
+	  _mm256_storeu_pd(d2+j+4, best1);
+	  _mm256_storeu_pd(bi,     bidx0);
+	  _mm256_storeu_pd(bi+4,   bidx1);
+	  for(unsigned int k = 0; k < 8; ++k)
+	    idx[j+k] = (std::size_t)(bi[k]);
+	}
+#elif defined(__SSE2__)
+      if(n > 0)
+	for(; j + 4 <= m; j += 4) {
+	  __m128d ax0   = _mm_set_pd(at[j+1].x, at[j].x), ay0 = _mm_set_pd(at[j+1].y, at[j].y);
+	  __m128d ax1   = _mm_set_pd(at[j+3].x, at[j+2].x), ay1 = _mm_set_pd(at[j+3].y, at[j+2].y);
+	  __m128d best0 = _mm_set1_pd(std::numeric_limits<double>::max()), best1 = best0;
+	  __m128d bidx0 = _mm_set1_pd(n), bidx1 = bidx0;
+	  __m128d i_pd  = _mm_setzero_pd(), one = _mm_set1_pd(1);
+	  for(std::size_t i = 0; i < n; ++i) {
+	    __m128d x     = _mm_load1_pd(xs+i);
+	    __m128d y     = _mm_load1_pd(ys+i);
+	    __m128d dx0   = _mm_sub_pd(ax0, x), dy0 = _mm_sub_pd(ay0, y);
+	    __m128d dx1   = _mm_sub_pd(ax1, x), dy1 = _mm_sub_pd(ay1, y);
+	    __m128d r20   = _mm_add_pd(_mm_mul_pd(dx0,dx0), _mm_mul_pd(dy0,dy0));
+	    __m128d r21   = _mm_add_pd(_mm_mul_pd(dx1,dx1), _mm_mul_pd(dy1,dy1));
+	    __m128d less0 = _mm_cmplt_pd(r20, best0);
+	    __m128d less1 = _mm_cmplt_pd(r21, best1);
+	    best0 = _mm_min_pd(r20, best0);
+	    best1 = _mm_min_pd(r21, best1);
+	    bidx0 = _mm_or_pd(_mm_and_pd(less0, i_pd), _mm_andnot_pd(less0, bidx0));
+	    bidx1 = _mm_or_pd(_mm_and_pd(less1, i_pd), _mm_andnot_pd(less1, bidx1));
+	    i_pd  = _mm_add_pd(i_pd, one);
+	  }
+	  double bi[4];
+	  _mm_storeu_pd(d2+j,   best0);
+	  _mm_storeu_pd(d2+j+2, best1);
+	  _mm_storeu_pd(bi,     bidx0);
+	  _mm_storeu_pd(bi+2,   bidx1);
+	  for(unsigned int k = 0; k < 4; ++k)
+	    idx[j+k] = (std::size_t)(bi[k]);
+	}
+#endif
+
+      for(; j < m; ++j)
+	std::tie(idx[j], d2[j]) = closest(xs, ys, n, at[j]);
+    }
+  }
+}
@@ -9,6 +9,7 @@ namespace elec {
   private:
     bool generate_mode, movie;
     std::string pyfile, moviefile;
+    unsigned int random_seed;
 
   public:
 
@@ -18,25 +19,38 @@ namespace elec {
     Main& operator=(const Main& )  = delete;
     Main& operator=(const Main&&)  = delete;
 
+    /**
+     * The optional argument after the mode is the seed of the run,
+     * the current time by default (see seed). It also seeds
+     * std::rand, for the free functions drawing at random.
+     */
     Main(int argc, char** argv, const std::string& prefix) {
-      srand(std::time(0));
       pyfile = prefix+".py";
       moviefile = prefix+".mp4";
-      if(argc != 2) {
+      if(argc != 2 && argc != 3) {
 	std::cerr << std::endl
 		  << "Usage : " << std::endl
 		  << std::endl
 		  << argv[0] << " movie" << std::endl
 		  << argv[0] << " display" << std::endl
 		  << "-----------------" << std::endl
-		  << argv[0] << " run | ./" << pyfile << std::endl
+		  << argv[0] << " run [seed] | ./" << pyfile << std::endl
 		  << std::endl;
 	std::exit(0);
       }
       generate_mode = std::string(argv[1])=="movie" || std::string(argv[1])=="display";
       movie         = std::string(argv[1])=="movie";
+      random_seed   = argc == 3 ? std::strtoul(argv[2], nullptr, 10) : std::time(0);
+      std::srand(random_seed);
     }
 
+    /**
+     * The seed of the run, to be given to the worlds (see
+     * World::set_seed), so that a run does not depend on the calls to
+     * std::rand made before the worlds are built.
+     */
+    unsigned int seed() const {return random_seed;}
+
     void generate(ccmpl::chart::Layout& display) {
       if(generate_mode) {
 	if(movie)
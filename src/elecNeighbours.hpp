@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <initializer_list>
+
+#include <elecPoint.hpp>
+
+/* Above this, the cells of a NeighbourGrid are enlarged. */
+#define elecNEIGHBOURS_MAX_CELLS 1000000
+
+namespace elec {
+
+  /**
+   * Uniform grid of cells over a rectangle, storing the positions of
+   * indexed points (the electrons) for nearest neighbour queries.
+   * Points outside the rectangle are stored in the border cells, so
+   * that any point can be handled: the distance between positions
+   * clamped into the rectangle never exceeds the actual one, so the
+   * search bounds stay valid.
+   *
+   * With cells of the size of the typical distance between points, a
+   * query only visits a few cells.
+   */
+  class NeighbourGrid {
+  private:
+
+    struct Entry {
+      Point        pos;
+      unsigned int idx;
+    };
+
+    Point                           min;
+    double                          cell_size;
+    int                             nx, ny;
+    std::vector<std::vector<Entry>> cells;
+    std::vector<unsigned int>       cell_of, slot_of;
+
+    int col(double x) const {return std::max(0, std::min(nx-1, (int)std::floor((x-min.x)/cell_size)));}
+    int row(double y) const {return std::max(0, std::min(ny-1, (int)std::floor((y-min.y)/cell_size)));}
+
+    void insert(unsigned int idx, const Point& pos) {
+      unsigned int c = row(pos.y)*nx + col(pos.x);
+      cell_of[idx] = c;
+      slot_of[idx] = cells[c].size();
+      cells[c].push_back({pos, idx});
+    }
+
+    void remove(unsigned int idx) {
+      auto& cell = cells[cell_of[idx]];
+      unsigned int s = slot_of[idx];
+      cell[s] = cell.back();
+      slot_of[cell[s].idx] = s;
+      cell.pop_back();
+    }
+
+  public:
+
+    NeighbourGrid() : min(), cell_size(1), nx(1), ny(1), cells(1), cell_of(), slot_of() {}
+
+    /**
+     * Covers the rectangle [bmin,bmax] with cells of the given size,
+     * and inserts the points.
+     */
+    template<typename Iter>
+    void build(const Point& bmin, const Point& bmax, double size, const Iter& begin, const Iter& end) {
+      min       = bmin;
+      cell_size = size;
+      Point  d  = bmax - bmin;
+      double nb = std::ceil(d.x/cell_size)*std::ceil(d.y/cell_size);
+      if(nb > elecNEIGHBOURS_MAX_CELLS)
+	cell_size *= std::sqrt(nb/elecNEIGHBOURS_MAX_CELLS);
+      nx = std::max(1, (int)std::ceil(d.x/cell_size));
+      ny = std::max(1, (int)std::ceil(d.y/cell_size));
+      cells.assign(nx*ny, std::vector<Entry>());
+      cell_of.clear();
+      slot_of.clear();
+      unsigned int idx = 0;
+      for(auto it = begin; it != end; ++it, ++idx) {
+	cell_of.push_back(0);
+	slot_of.push_back(0);
+	insert(idx, *it);
+      }
+    }
+
+    unsigned int size() const {return cell_of.size();}
+
+    /**
+     * The rectangle covered by the cells.
+     */
+    std::pair<Point,Point> bbox() const {
+      return {min, min + Point(nx,ny)*cell_size};
+    }
+
+    double cell() const {return cell_size;}
+
+    /**
+     * The point of the rectangle where p is stored.
+     */
+    Point clamp(const Point& p) const {
+      return {std::max(min.x, std::min(min.x + nx*cell_size, p.x)),
+	      std::max(min.y, std::min(min.y + ny*cell_size, p.y))};
+    }
+
+    /**
+     * Point idx is now at pos.
+     */
+    void update(unsigned int idx, const Point& pos) {
+      auto& e = cells[cell_of[idx]][slot_of[idx]];
+      if(row(pos.y)*nx + col(pos.x) == (int)cell_of[idx])
+	e.pos = pos;
+      else {
+	remove(idx);
+	insert(idx, pos);
+      }
+    }
+
+    /**
+     * Appends to xs, ys the points which are at most at radius from
+     * center, except the ones located at exclude.
+     */
+    void gather(const Point& center, double radius, const Point& exclude,
+		std::vector<double>& xs, std::vector<double>& ys) const {
+      double r2 = radius*radius;
+      for(int j = row(center.y - radius); j <= row(center.y + radius); ++j)
+	for(int i = col(center.x - radius); i <= col(center.x + radius); ++i)
+	  for(auto& e : cells[j*nx+i])
+	    if(e.pos != exclude && d2(e.pos,center) <= r2) {
+	      xs.push_back(e.pos.x);
+	      ys.push_back(e.pos.y);
+	    }
+    }
+
+    /**
+     * Calls fn(idx) for each point idx at most at radius from center.
+     */
+    template<typename Fn>
+    void visit(const Point& center, double radius, const Fn& fn) const {
+      double r2 = radius*radius;
+      for(int j = row(center.y - radius); j <= row(center.y + radius); ++j)
+	for(int i = col(center.x - radius); i <= col(center.x + radius); ++i)
+	  for(auto& e : cells[j*nx+i])
+	    if(d2(e.pos,center) <= r2)
+	      fn(e.idx);
+    }
+
+    /**
+     * The closest point to p, which is not located at exclude, with
+     * its squared distance. The distance is the largest double if
+     * there is no such point.
+     */
+    std::pair<Point,double> closest(const Point& p, const Point& exclude) const {
+      return closest(p, exclude, [](const Point&) {return false;});
+    }
+
+    /**
+     * Same as above, ignoring the points for which skip(pos) holds.
+     */
+    template<typename Skip>
+    std::pair<Point,double> closest(const Point& p, const Point& exclude, const Skip& skip) const {
+      std::pair<Point,double> res = {Point(0,0),std::numeric_limits<double>::max()};
+      Point q  = clamp(p);
+      int   ci = col(q.x);
+      int   cj = row(q.y);
+      // Distance from q to the sides of its cell.
+      double margin = std::max(0., std::min({q.x - (min.x + ci*cell_size), min.x + (ci+1)*cell_size - q.x,
+					      q.y - (min.y + cj*cell_size), min.y + (cj+1)*cell_size - q.y}));
+      int max_ring = std::max(std::max(ci, nx-1-ci), std::max(cj, ny-1-cj));
+      for(int ring = 0; ring <= max_ring; ++ring) {
+	for(int j = std::max(cj-ring, 0); j <= std::min(cj+ring, ny-1); ++j) {
+	  bool side = (j == cj-ring || j == cj+ring);
+	  int  step = side ? 1 : 2*ring;
+	  for(int i = ci-ring; i <= ci+ring; i += step) {
+	    if(i < 0 || i >= nx)
+	      continue;
+	    for(auto& e : cells[j*nx+i]) {
+	      double dd;
+	      if(e.pos != exclude && (dd = d2(e.pos,p)) < res.second && !skip(e.pos))
+		res = {e.pos,dd};
+	    }
+	  }
+	}
+	// The points in the next rings are at least that far.
+	double bound = ring*cell_size + margin;
+	if(res.second <= bound*bound)
+	  break;
+      }
+      return res;
+    }
+  };
+}
@@ -13,7 +13,13 @@
 #define elecNOISE_RADIUS_MAX .002
 #define elecNB_NOISE_TRIES 5
 #define elecNOISE_NB_TRIES_INSIDE 10
+#define elecNOISE_DISTANCE_SLACK 1e-9 // against rounding, in the distance tests
 
 #define elecELEMENTARY_CHARGE 1e-2
 
 #define elecMAX_VARIATION .03
+
+#define elecMOVE_BLOCK 64 // electrons whose field is computed at once
+#define elecWALL_CHUNK 8  // wall candidates scored at once
+#define elecSLEEP_RADIUS elecMAX_VARIATION // motion of a settled electron, see World::set_sleep
+#define elecWAKE_SHIFT .01  // shift of the wall target which wakes a sleeping electron up
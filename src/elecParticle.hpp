@@ -8,12 +8,19 @@
 
 #include <elecParams.hpp>
 #include <elecPoint.hpp>
+#include <elecRandom.hpp>
 #include <elecArea.hpp>
 
 namespace elec {
 
-  bool proba(double p) {
-    return std::rand()/(1.0+RAND_MAX) < p;
+  template<typename Rng>
+  bool proba(double p, Rng& rng) {
+    return rng() < p;
+  }
+
+  inline bool proba(double p) {
+    StdRand rng;
+    return proba(p, rng);
   }
 
   // inline Point E(const Point& p, const Point& at) {
@@ -63,15 +70,15 @@ namespace elec {
     return v;
   }
 
-  template<typename OutputIterator>
-  unsigned int add_particles_random(AreaRef a, OutputIterator& out) {
+  template<typename OutputIterator, typename Rng>
+  unsigned int add_particles_random(AreaRef a, OutputIterator& out, Rng& rng) {
     Point min,max;
     std::tie(min,max) = a->bbox();
     unsigned int nb_elems = 0;
     unsigned int n = (unsigned int)(elecDENSITY*(max.x-min.x)*(max.y-min.y)+.5);
     for(unsigned int i = 0; i < n; ++i) {
-      auto p = elec::uniform(min,max);
-      if(elec::proba(a->density(p))) {
+      auto p = elec::uniform(min,max,rng);
+      if(elec::proba(a->density(p),rng)) {
 	*(out++) = p;
 	++nb_elems;
       }
@@ -80,16 +87,28 @@ namespace elec {
   }
 
   template<typename OutputIterator>
-  void add_particles_random(AreaRef a,  unsigned int nb, OutputIterator& out) {
+  unsigned int add_particles_random(AreaRef a, OutputIterator& out) {
+    StdRand rng;
+    return add_particles_random(a, out, rng);
+  }
+
+  template<typename OutputIterator, typename Rng>
+  void add_particles_random(AreaRef a,  unsigned int nb, OutputIterator& out, Rng& rng) {
     Point min,max;
     std::tie(min,max) = a->bbox();
     for(unsigned int i = 0; i < nb; ++i) {
       Point p;
       do
-	p = elec::uniform(min,max); 
-      while(!elec::proba(a->density(p)));
+	p = elec::uniform(min,max,rng); 
+      while(!elec::proba(a->density(p),rng));
       *(out++) = p;
     }
   }
 
+  template<typename OutputIterator>
+  void add_particles_random(AreaRef a,  unsigned int nb, OutputIterator& out) {
+    StdRand rng;
+    add_particles_random(a, nb, out, rng);
+  }
+
 }
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <iterator>
+
+#include <elecPoint.hpp>
+#include <elecKernels.hpp>
+
+#include <ccmpl.hpp>
+
+namespace elec {
+
+  /**
+   * Particle positions stored as a structure of arrays (contiguous x
+   * and y arrays), so that the field kernels can stream them. It
+   * behaves as a container of points: iterators dereference into a
+   * reference object, which reads as a Point and can be assigned
+   * from a Point.
+   *
+   * The coordinates are stored as Real, while they are read and
+   * written as Point (double). Storing them as float halves the
+   * memory traffic of the field kernels.
+   */
+  template<typename Real>
+  class basic_particles {
+  private:
+
+    std::vector<Real> xs, ys;
+
+  public:
+
+    using value_type = Point;
+    using size_type  = std::size_t;
+
+    class reference {
+    public:
+      Real& x;
+      Real& y;
+
+      reference(Real& x, Real& y) : x(x), y(y) {}
+      reference(const reference&) = default;
+
+      reference& operator=(const reference& r) {
+	x = r.x;
+	y = r.y;
+	return *this;
+      }
+
+      reference& operator=(const Point& p) {
+	x = Real(p.x);
+	y = Real(p.y);
+	return *this;
+      }
+
+      operator Point        () const {return {x,y};}
+      operator ccmpl::Point () const {return ccmpl::Point(x,y);}
+    };
+
+    template<typename Owner, typename Ref>
+    class basic_iterator {
+    private:
+      Owner*    owner;
+      size_type idx;
+    public:
+      using iterator_category = std::random_access_iterator_tag;
+      using value_type        = Point;
+      using difference_type   = std::ptrdiff_t;
+      using pointer           = void;
+      using reference         = Ref;
+
+      basic_iterator() : owner(nullptr), idx(0) {}
+      basic_iterator(Owner* owner, size_type idx) : owner(owner), idx(idx) {}
+      basic_iterator(const basic_iterator&) = default;
+      basic_iterator& operator=(const basic_iterator&) = default;
+
+      Ref              operator* ()                         const {return (*owner)[idx];}
+      Ref              operator[](difference_type n)        const {return (*owner)[idx+n];}
+      basic_iterator&  operator++()                               {++idx; return *this;}
+      basic_iterator&  operator--()                               {--idx; return *this;}
+      basic_iterator   operator++(int)                            {auto res = *this; ++idx; return res;}
+      basic_iterator   operator--(int)                            {auto res = *this; --idx; return res;}
+      basic_iterator&  operator+=(difference_type n)              {idx += n; return *this;}
+      basic_iterator&  operator-=(difference_type n)              {idx -= n; return *this;}
+      basic_iterator   operator+ (difference_type n)        const {return {owner, idx+n};}
+      basic_iterator   operator- (difference_type n)        const {return {owner, idx-n};}
+      difference_type  operator- (const basic_iterator& it) const {return difference_type(idx) - difference_type(it.idx);}
+      bool             operator==(const basic_iterator& it) const {return idx == it.idx;}
+      bool             operator!=(const basic_iterator& it) const {return idx != it.idx;}
+      bool             operator< (const basic_iterator& it) const {return idx <  it.idx;}
+      bool             operator> (const basic_iterator& it) const {return idx >  it.idx;}
+      bool             operator<=(const basic_iterator& it) const {return idx <= it.idx;}
+      bool             operator>=(const basic_iterator& it) const {return idx >= it.idx;}
+    };
+
+    using iterator       = basic_iterator<basic_particles,       reference>;
+    using const_iterator = basic_iterator<const basic_particles, Point>;
+
+    basic_particles() : xs(), ys() {}
+    basic_particles(const basic_particles&) = default;
+    basic_particles& operator=(const basic_particles&) = default;
+
+    size_type size()  const {return xs.size();}
+    bool      empty() const {return xs.empty();}
+    void      clear()                 {xs.clear();     ys.clear();}
+    void      reserve(size_type n)    {xs.reserve(n);  ys.reserve(n);}
+    void      push_back(const Point& p) {xs.push_back(Real(p.x)); ys.push_back(Real(p.y));}
+
+    reference operator[](size_type i)       {return {xs[i], ys[i]};}
+    Point     operator[](size_type i) const {return {xs[i], ys[i]};}
+
+    iterator       begin()        {return {this, 0};}
+    iterator       end()          {return {this, size()};}
+    const_iterator begin()  const {return {this, 0};}
+    const_iterator end()    const {return {this, size()};}
+    const_iterator cbegin() const {return {this, 0};}
+    const_iterator cend()   const {return {this, size()};}
+
+    const Real* x() const {return xs.data();}
+    const Real* y() const {return ys.data();}
+  };
+
+  using Particles = basic_particles<double>;
+
+  template<typename Real>
+  Point E(const basic_particles<Real>& particles, const Point& at) {
+    return Point(kernel::E(particles.x(), particles.y(), particles.size(), basic_point<Real>(at)));
+  }
+
+  template<typename Real>
+  double V(const basic_particles<Real>& particles, const Point& at) {
+    return kernel::V(particles.x(), particles.y(), particles.size(), basic_point<Real>(at));
+  }
+
+  template<typename Real>
+  void E_batch(const basic_particles<Real>& particles, const Point* at, Point* out, std::size_t m) {
+    std::vector<basic_point<Real>> at_r, out_r(m);
+    for(std::size_t j = 0; j < m; ++j) at_r.push_back(basic_point<Real>(at[j]));
+    kernel::E_batch(particles.x(), particles.y(), particles.size(), at_r.data(), out_r.data(), m);
+    for(std::size_t j = 0; j < m; ++j) out[j] += Point(out_r[j]);
+  }
+
+  template<typename Real>
+  void V_batch(const basic_particles<Real>& particles, const Point* at, double* out, std::size_t m) {
+    std::vector<basic_point<Real>> at_r;
+    std::vector<Real>              out_r(m, 0);
+    for(std::size_t j = 0; j < m; ++j) at_r.push_back(basic_point<Real>(at[j]));
+    kernel::V_batch(particles.x(), particles.y(), particles.size(), at_r.data(), out_r.data(), m);
+    for(std::size_t j = 0; j < m; ++j) out[j] += out_r[j];
+  }
+
+  inline void E_batch(const Particles& particles, const Point* at, Point* out, std::size_t m) {
+    kernel::E_batch(particles.x(), particles.y(), particles.size(), at, out, m);
+  }
+
+  inline void V_batch(const Particles& particles, const Point* at, double* out, std::size_t m) {
+    kernel::V_batch(particles.x(), particles.y(), particles.size(), at, out, m);
+  }
+}
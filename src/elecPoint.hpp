@@ -32,110 +32,123 @@
 #include <iostream>
 #include <algorithm>
 #include <ccmpl.hpp>
+#include <elecParams.hpp>
+#include <elecRandom.hpp>
 
 namespace elec {
-  class Point {
+
+  /**
+   * A 2D point, with coordinates of type Real. The simulation uses
+   * Point, i.e. double coordinates; other precisions are meant for
+   * storing particles (see basic_world).
+   */
+  template<typename Real>
+  class basic_point {
   public:
-    double x,y;
+    using real_type = Real;
+
+    Real x,y;
     
-    Point() : x(0), y(0) {}
-    Point(const Point& cp) : x(cp.x), y(cp.y) {}
-    Point(double xx, double yy) : x(xx), y(yy) {}
-    Point& operator=(const Point& cp) {
+    basic_point() : x(0), y(0) {}
+    basic_point(const basic_point& cp) : x(cp.x), y(cp.y) {}
+    basic_point(Real xx, Real yy) : x(xx), y(yy) {}
+    template<typename Other>
+    explicit basic_point(const basic_point<Other>& cp) : x(Real(cp.x)), y(Real(cp.y)) {}
+    basic_point& operator=(const basic_point& cp) {
       x = cp.x;
       y = cp.y;
       return *this;
     }
 
-    Point& operator=(double val) {
+    basic_point& operator=(Real val) {
       x = val;
       y = val;
       return *this;
     }
   
-    bool operator==(const Point& p) const {
+    bool operator==(const basic_point& p) const {
       return x == p.x && y == p.y;
     }
   
-    bool operator<(const Point& p) const {
+    bool operator<(const basic_point& p) const {
       return x < p.x && y < p.y;
     }
 
-    bool operator>(const Point& p) const {
+    bool operator>(const basic_point& p) const {
       return x > p.x && y > p.y;
     }
   
-    bool operator<=(const Point& p) const {
+    bool operator<=(const basic_point& p) const {
       return x <= p.x && y <= p.y;
     }
 
-    bool operator>=(const Point& p) const {
+    bool operator>=(const basic_point& p) const {
       return x >= p.x && y >= p.y;
     }
   
-    bool operator!=(const Point& p) const {
+    bool operator!=(const basic_point& p) const {
       return x != p.x || y != p.y;
     }
 
-    Point operator+(const Point& p) const {
+    basic_point operator+(const basic_point& p) const {
       return {x+p.x, y+p.y};
     }
   
-    Point operator-() const {
+    basic_point operator-() const {
       return {-x,-y};
     }
 
-    Point operator+() const {
+    basic_point operator+() const {
       return {x,y};
     }
 
-    Point operator-(const Point& p) const {
+    basic_point operator-(const basic_point& p) const {
       return {x-p.x, y-p.y};
     }
   
-    double operator*(const Point& p) const {
+    Real operator*(const basic_point& p) const {
       return x*p.x + y*p.y;
     }
 
-    Point operator&(const Point& p) const {
+    basic_point operator&(const basic_point& p) const {
       return {x*p.x, y*p.y};
     }
 
     /**
      * Unitary vector.
      */
-    Point operator*() const {
-      const Point& me = *this;
+    basic_point operator*() const {
+      const basic_point& me = *this;
       return me/std::sqrt(me*me);
     }
 
-    Point operator*(double a) const {
+    basic_point operator*(Real a) const {
       return {x*a, y*a};
     }
 
-    Point operator/(double a) const {
+    basic_point operator/(Real a) const {
       return (*this)*(1/a);
     }
 
-    Point& operator+=(const Point& p) {
+    basic_point& operator+=(const basic_point& p) {
       x += p.x;
       y += p.y;
       return *this;
     }
 
-    Point& operator-=(const Point& p) {
+    basic_point& operator-=(const basic_point& p) {
       x -= p.x;
       y -= p.y;
       return *this;
     }
   
-    Point& operator*=(double a) {
+    basic_point& operator*=(Real a) {
       x *= a;
       y *= a;
       return *this;
     }
   
-    Point& operator/=(double a) {
+    basic_point& operator/=(Real a) {
       (*this)*=(1/a);
       return *this;
     }
@@ -145,55 +158,106 @@ namespace elec {
     }
   };
 
-  inline elec::Point operator*(double a, const elec::Point p) {
+  using Point = basic_point<double>;
+
+  template<typename Real>
+  inline basic_point<Real> operator*(typename basic_point<Real>::real_type a, const basic_point<Real>& p) {
     return p*a;
   }
 
+  template<typename Real>
   inline std::ostream& operator<<(std::ostream& os, 
-				  const Point& p) {
+				  const basic_point<Real>& p) {
     os << '(' << p.x << ", " << p.y << ')';
     return os;
   }
 
+  template<typename Real>
   inline std::ostream& operator<<(std::ostream& os, 
-				  const std::pair<Point,Point> p) {
+				  const std::pair<basic_point<Real>,basic_point<Real>> p) {
     os << "(" << p.first << "," << p.second << ")";
     return os;
   }
 
-  inline Point uniform(const Point& A, const Point& B) {
-    Point d = {std::rand()/(RAND_MAX+1.0),
-	       std::rand()/(RAND_MAX+1.0)};
+  /* The functions drawing at random take a generator of uniform
+     numbers in [0,1) (see elecRandom.hpp), std::rand by default. */
+
+  template<typename Rng>
+  inline Point uniform(const Point& A, const Point& B, Rng& rng) {
+    Point d = {rng(), rng()};
     return A + (d & (B-A));
   }
+
+  inline Point uniform(const Point& A, const Point& B) {
+    StdRand rng;
+    return uniform(A, B, rng);
+  }
   
-  inline double d2(const Point& A, const Point& B) {
-    Point tmp = B-A;
+  template<typename Real>
+  inline Real d2(const basic_point<Real>& A, const basic_point<Real>& B) {
+    basic_point<Real> tmp = B-A;
     return tmp*tmp;
   }
 
-  inline double d(const Point& A, const Point& B) {
+  template<typename Real>
+  inline Real d(const basic_point<Real>& A, const basic_point<Real>& B) {
     return std::sqrt(d2(A,B));
   }
 
-  inline Point min(const Point& A, const Point& B) {
+  template<typename Real>
+  inline basic_point<Real> min(const basic_point<Real>& A, const basic_point<Real>& B) {
     return {std::min(A.x,B.x),std::min(A.y,B.y)};
   }
 
-  inline Point max(const Point& A, const Point& B) {
+  template<typename Real>
+  inline basic_point<Real> max(const basic_point<Real>& A, const basic_point<Real>& B) {
     return {std::max(A.x,B.x),std::max(A.y,B.y)};
   }
   
-  inline Point shake(const Point& A, double radius_max, double radius2_min, double radius2_max) {
+  template<typename Rng>
+  inline Point shake(const Point& A, double radius_max, double radius2_min, double radius2_max, Rng& rng) {
     Point p;
     Point   R = {radius_max,radius_max};
     double d_2;
     do {
-      p  = uniform(A-R,A+R);
+      p  = uniform(A-R,A+R,rng);
       d_2 = d2(p,A);
     }
     while(d_2>radius2_max || d_2<radius2_min);
     return p;
   }
 
+  inline Point shake(const Point& A, double radius_max, double radius2_min, double radius2_max) {
+    StdRand rng;
+    return shake(A, radius_max, radius2_min, radius2_max, rng);
+  }
+
+  /**
+   * Draws p uniformly in the annulus of center A, restricted to the
+   * half plane n*(p-A) <= h, n being a unit vector. The radius is drawn
+   * with its density in the annulus and kept with the proportion of
+   * its circle lying in the half plane; the angle is then drawn within
+   * that arc. Returns false if the half plane misses the annulus, or
+   * only grazes it (the arcs, the largest of which is on the outer
+   * circle, are then too small to be drawn).
+   */
+  template<typename Rng>
+  inline bool shake_clipped(const Point& A, double radius_min, double radius_max,
+			    const Point& n, double h, Point& p, Rng& rng) {
+    double rmin = std::max(radius_min, -h);
+    if(rmin > radius_max)
+      return false;
+    if(elecPI - std::acos(std::max(-1., std::min(1., h/radius_max))) < 1e-6)
+      return false;
+    double rho, alpha;
+    do {
+      rho   = std::sqrt(rmin*rmin + rng()*(radius_max*radius_max - rmin*rmin));
+      alpha = std::acos(std::max(-1., std::min(1., h/rho))); // half of the arc out of the half plane.
+    }
+    while(rng()*elecPI >= elecPI - alpha);
+    double theta = alpha + rng()*2*(elecPI - alpha);
+    p = A + rho*(std::cos(theta)*n + std::sin(theta)*Point(-n.y, n.x));
+    return true;
+  }
+
 }
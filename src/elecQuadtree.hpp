@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include <elecParams.hpp>
+#include <elecPoint.hpp>
+#include <elecParticle.hpp>
+#include <elecField.hpp>
+#include <elecTaylor.hpp>
+
+#define elecQUADTREE_MAX_DEPTH 32
+
+namespace elec {
+
+  /**
+   * Barnes-Hut field engine. Charges are stored in a quadtree whose
+   * cells carry Taylor moments about their geometric center. A cell
+   * of width s seen from a distance d is approximated by its moments
+   * when s < theta*d, and if it cannot contain a charge closer than
+   * elecMIN_E_RADIUS. Otherwise it is opened, and leaves are summed
+   * directly.
+   *
+   * The engine is incremental: a moved charge stays in its leaf, the
+   * moments of the cells from that leaf to the root are corrected,
+   * and the radius of these cells is enlarged if needed so that the
+   * opening test remains valid. This costs O(log N). After as many
+   * updates as charges, the tree asks to be built again.
+   */
+  class BarnesHut : public Field {
+  private:
+
+    struct Node {
+      Point        center;
+      double       radius;     // no charge of the cell is farther from center.
+      unsigned int parent;
+      unsigned int child;      // first of the 4 children, 0 for a leaf.
+      unsigned int begin, end; // charges of the cell, in sorted.
+    };
+
+    double                    theta;
+    unsigned int              order;
+    unsigned int              leaf_size;
+    unsigned int              nb_terms;
+    std::vector<Charge>       sorted;
+    std::vector<Node>         nodes;
+    std::vector<double>       moments;
+    std::vector<unsigned int> rank;    // rank in sorted of the built charges.
+    std::vector<unsigned int> leaf_of; // leaf of each sorted charge.
+    std::size_t               nb_updates;
+
+    /* The charges are permuted through perm, with half the cell width. */
+    void split(unsigned int n, double half, unsigned int depth, std::vector<unsigned int>& perm) {
+      Node node = nodes[n];
+      if(node.end - node.begin <= leaf_size || depth >= elecQUADTREE_MAX_DEPTH)
+	return;
+
+      auto first = perm.begin() + node.begin;
+      auto last  = perm.begin() + node.end;
+      const Point& c = node.center;
+      const std::vector<Charge>& ch = sorted;
+      auto mid   = std::partition(first, last, [&c,&ch](unsigned int i) {return ch[i].pos.y < c.y;});
+      auto low   = std::partition(first, mid,  [&c,&ch](unsigned int i) {return ch[i].pos.x < c.x;});
+      auto high  = std::partition(mid,   last, [&c,&ch](unsigned int i) {return ch[i].pos.x < c.x;});
+
+      unsigned int bounds[5] = {node.begin,
+				(unsigned int)(low  - perm.begin()),
+				(unsigned int)(mid  - perm.begin()),
+				(unsigned int)(high - perm.begin()),
+				node.end};
+      double h = .5*half;
+      Point offsets[4] = {{-h,-h}, {h,-h}, {-h,h}, {h,h}};
+
+      unsigned int child = nodes.size();
+      nodes[n].child = child;
+      for(unsigned int k = 0; k < 4; ++k)
+	nodes.push_back({node.center + offsets[k], h*std::sqrt(2.0), n, 0, bounds[k], bounds[k+1]});
+      for(unsigned int k = 0; k < 4; ++k)
+	split(child+k, h, depth+1, perm);
+    }
+
+    bool is_far(const Node& node, const Point& at) const {
+      double dd = d2(node.center,at);
+      double r  = node.radius;
+      if(2*r*r >= theta*theta*dd)
+	return false;
+      r += elecMIN_E_RADIUS;
+      return dd > r*r;
+    }
+
+    /* e or v may be null if not needed. */
+    void evaluate(const Point& at, Point* e, double* v) const {
+      Point  ee = {0,0};
+      double vv = 0;
+      if(nodes.size() == 0) {
+	if(e) *e = ee;
+	if(v) *v = vv;
+	return;
+      }
+
+      double a_buf[elecTAYLOR_BUFFER_SIZE];
+      std::vector<double> a_big;
+      double* a = a_buf;
+      if(taylor::size(order+1) > elecTAYLOR_BUFFER_SIZE) {
+	a_big.resize(taylor::size(order+1));
+	a = a_big.data();
+      }
+      unsigned int stack[3*elecQUADTREE_MAX_DEPTH+4];
+      unsigned int top = 0;
+      stack[top++] = 0;
+      while(top != 0) {
+	const Node& node = nodes[stack[--top]];
+	if(node.end == node.begin)
+	  continue;
+	if(is_far(node,at)) {
+	  taylor::coulomb(at - node.center, order+1, a);
+	  taylor::evaluate(a, moments.data() + (&node - nodes.data())*nb_terms, order, ee, vv);
+	}
+	else if(node.child == 0) {
+	  if(e)
+	    for(unsigned int i = node.begin; i < node.end; ++i)
+	      ee += elec::E(sorted[i],at);
+	  if(v)
+	    for(unsigned int i = node.begin; i < node.end; ++i)
+	      vv += elec::V(sorted[i],at);
+	}
+	else
+	  for(unsigned int k = 0; k < 4; ++k)
+	    stack[top++] = node.child + k;
+      }
+      if(e) *e = ee;
+      if(v) *v = vv;
+    }
+
+  public:
+
+    /**
+     * @param theta the opening angle.
+     * @param order the degree of the Taylor moments (0 is the plain monopole).
+     * @param leaf_size the maximal number of charges in a leaf.
+     */
+    BarnesHut(double theta, unsigned int order, unsigned int leaf_size)
+      : Field(), theta(theta), order(order), leaf_size(leaf_size),
+	nb_terms(taylor::size(order)), sorted(), nodes(), moments(),
+	rank(), leaf_of(), nb_updates(0) {}
+    virtual ~BarnesHut() {}
+
+    virtual void build(const std::vector<Charge>& charges) override {
+      sorted = charges;
+      nodes.clear();
+      moments.clear();
+      nb_updates = 0;
+      if(sorted.size() == 0)
+	return;
+
+      Point min = sorted.front().pos;
+      Point max = min;
+      for(auto& c : sorted) {
+	min = elec::min(min,c.pos);
+	max = elec::max(max,c.pos);
+      }
+      double half = .5*std::max(max.x-min.x, max.y-min.y);
+      half += 1e-9*(1+half);
+      std::vector<unsigned int> perm(sorted.size());
+      for(unsigned int i = 0; i < perm.size(); ++i)
+	perm[i] = i;
+      nodes.push_back({(min+max)*.5, half*std::sqrt(2.0), 0, 0, 0, (unsigned int)(sorted.size())});
+      split(0,half,0,perm);
+
+      rank.resize(perm.size());
+      for(unsigned int i = 0; i < perm.size(); ++i) {
+	sorted[i]     = charges[perm[i]];
+	rank[perm[i]] = i;
+      }
+      leaf_of.resize(sorted.size());
+      for(unsigned int n = 0; n < nodes.size(); ++n)
+	if(nodes[n].child == 0)
+	  for(unsigned int i = nodes[n].begin; i < nodes[n].end; ++i)
+	    leaf_of[i] = n;
+
+      moments.assign(nodes.size()*nb_terms, 0);
+      double* m = moments.data();
+      for(auto& node : nodes) {
+	for(unsigned int i = node.begin; i < node.end; ++i)
+	  taylor::add_moments(sorted[i].pos - node.center, sorted[i].q, order, m);
+	m += nb_terms;
+      }
+    }
+
+    virtual Point E(const Point& at) const override {
+      Point e;
+      evaluate(at,&e,nullptr);
+      return e;
+    }
+
+    virtual double V(const Point& at) const override {
+      double v;
+      evaluate(at,nullptr,&v);
+      return v;
+    }
+
+    virtual bool incremental() const override {return true;}
+
+    virtual bool update(std::size_t idx, const Point& to) override {
+      if(++nb_updates > sorted.size())
+	return false;
+      Charge& c = sorted[rank[idx]];
+      for(unsigned int n = leaf_of[rank[idx]]; ; n = nodes[n].parent) {
+	Node&   node = nodes[n];
+	double* m    = moments.data() + n*nb_terms;
+	taylor::add_moments(c.pos - node.center, -c.q, order, m);
+	taylor::add_moments(to    - node.center,  c.q, order, m);
+	node.radius = std::max(node.radius, d(to,node.center));
+	if(n == 0)
+	  break;
+      }
+      c.pos = to;
+      return true;
+    }
+  };
+
+  inline FieldRef barnes_hut(double theta, unsigned int order = 2, unsigned int leaf_size = 8) {
+    return FieldRef(static_cast<Field*>(new BarnesHut(theta,order,leaf_size)));
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+
+namespace elec {
+
+  /**
+   * Uniform draws in [0,1), from std::rand. This is the generator of
+   * the free functions drawing at random, seeded by std::srand.
+   */
+  struct StdRand {
+    double operator()() const {return std::rand()/(RAND_MAX+1.0);}
+  };
+
+  /**
+   * Uniform draws in [0,1), from the Philox4x32-10 counter-based
+   * generator (Salmon et al., SC'11). The draws of a generator are the
+   * encryptions of successive counters under a key: they only depend
+   * on (seed, step, index), so that each electron of each move draws
+   * its own numbers, whatever the thread running it or the platform.
+   * The counter holds the block, the index (64 bits) and the step (32
+   * bits): the steps wrap around after 2^32 moves. A block of 128 bits
+   * gives two doubles of 53 bits.
+   */
+  class Philox {
+  private:
+
+    std::uint32_t key[2], counter[4], block[4];
+    unsigned int  used;
+
+    static void round(std::uint32_t* c, const std::uint32_t* k) {
+      std::uint64_t p0 = (std::uint64_t)0xD2511F53u * c[0];
+      std::uint64_t p1 = (std::uint64_t)0xCD9E8D57u * c[2];
+      std::uint32_t c1 = c[1], c3 = c[3];
+      c[0] = (std::uint32_t)(p1 >> 32) ^ c1 ^ k[0];
+      c[1] = (std::uint32_t)p1;
+      c[2] = (std::uint32_t)(p0 >> 32) ^ c3 ^ k[1];
+      c[3] = (std::uint32_t)p0;
+    }
+
+    void next_block() {
+      std::uint32_t k[2] = {key[0], key[1]};
+      for(unsigned int i = 0; i < 4; ++i) block[i] = counter[i];
+      for(unsigned int r = 0; r < 10; ++r) {
+	round(block, k);
+	k[0] += 0x9E3779B9u;
+	k[1] += 0xBB67AE85u;
+      }
+      ++counter[0];
+      used = 0;
+    }
+
+  public:
+
+    Philox(std::uint64_t seed, std::uint32_t step, std::uint64_t index)
+      : key{(std::uint32_t)seed, (std::uint32_t)(seed >> 32)},
+	counter{0, (std::uint32_t)index, (std::uint32_t)(index >> 32), step},
+	block(), used(4) {}
+
+    /**
+     * The next 32 random bits.
+     */
+    std::uint32_t bits() {
+      if(used == 4)
+	next_block();
+      return block[used++];
+    }
+
+    double operator()() {
+      std::uint32_t a = bits() >> 5, b = bits() >> 6;
+      return (a*67108864.0 + b)*(1.0/9007199254740992.0); // 53 bits.
+    }
+  };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cmath>
+#include <algorithm>
+
+#include <elecPoint.hpp>
+#include <elecArea.hpp>
+#include <elecCompiled.hpp>
+
+/* Above this, the cells of a RasterArea are enlarged. */
+#define elecRASTER_MAX_CELLS 4000000
+
+namespace elec {
+
+  /**
+   * The properties of a compiled area, tabulated on a grid of square
+   * cells over its bounding box. A cell which is uniform (see
+   * CompiledArea::uniform) answers the queries from the table, with a
+   * single memory load; the other cells, which cross a boundary, and
+   * the points out of the grid fall back on the exact queries. The
+   * answers are thus the ones of the compiled area.
+   *
+   * The area keeps its own copy of the compiled area.
+   */
+  class RasterArea : public Area {
+  private:
+
+    CompiledArea               exact;
+    Point                      min;
+    double                     cell_size;
+    int                        nx, ny;
+    std::vector<Properties>    cells;
+    std::vector<unsigned char> is_uniform;
+
+    /* The uniform cell containing pos, if any. */
+    const Properties* find(const Point& pos) const {
+      double u = (pos.x - min.x)/cell_size;
+      double v = (pos.y - min.y)/cell_size;
+      if(!(u >= 0 && v >= 0 && u < nx && v < ny))
+	return nullptr;
+      unsigned int c = (int)v*nx + (int)u;
+      return is_uniform[c] ? &(cells[c]) : nullptr;
+    }
+
+  public:
+
+    RasterArea() : Area(), exact(), min(), cell_size(1), nx(0), ny(0), cells(), is_uniform() {}
+    virtual ~RasterArea() {}
+
+    /**
+     * Tabulates the area with cells of the given size.
+     */
+    void build(const CompiledArea& area, double resolution) {
+      exact     = area;
+      cell_size = resolution;
+      cells.clear();
+      is_uniform.clear();
+      nx = ny = 0;
+      auto bb = exact.bbox();
+      if(!(bb.first <= bb.second))
+	return;
+      min       = bb.first;
+      Point  d  = bb.second - bb.first;
+      double nb = std::ceil(d.x/cell_size)*std::ceil(d.y/cell_size);
+      if(nb > elecRASTER_MAX_CELLS)
+	cell_size *= std::sqrt(nb/elecRASTER_MAX_CELLS);
+      nx = std::max(1, (int)std::ceil(d.x/cell_size));
+      ny = std::max(1, (int)std::ceil(d.y/cell_size));
+      cells.resize(nx*ny);
+      is_uniform.resize(nx*ny);
+      for(int j = 0; j < ny; ++j)
+	for(int i = 0; i < nx; ++i) {
+	  Point a = min + Point(i,j)*cell_size;
+	  Point b = min + Point(i+1,j+1)*cell_size;
+	  is_uniform[j*nx+i] = exact.uniform(a, b, cells[j*nx+i]);
+	}
+    }
+
+    /**
+     * The proportion of the cells which answer without the exact
+     * queries.
+     */
+    double uniform_ratio() const {
+      if(is_uniform.empty())
+	return 0;
+      return std::count(is_uniform.begin(), is_uniform.end(), 1)/(double)is_uniform.size();
+    }
+
+    virtual bool in(const Point& pos) const override {
+      if(auto c = find(pos)) return c->in;
+      return exact.in(pos);
+    }
+
+    virtual double mobility(const Point& pos) const override {
+      if(auto c = find(pos)) return c->mobility;
+      return exact.mobility(pos);
+    }
+
+    virtual double density(const Point& pos) const override {
+      if(auto c = find(pos)) return c->density;
+      return exact.density(pos);
+    }
+
+    virtual double min_d2(const Point& pos) const override {
+      if(auto c = find(pos)) return c->min_d2;
+      return exact.min_d2(pos);
+    }
+
+    virtual Properties query(const Point& pos) const override {
+      if(auto c = find(pos)) return *c;
+      return exact.query(pos);
+    }
+
+    virtual double distance(const Point& pos, double bound, Point& g) const override {
+      return exact.distance(pos, bound, g);
+    }
+
+    virtual std::pair<Point,Point> bbox() const override {
+      return exact.bbox();
+    }
+
+    virtual double largest_min_d2() const override {
+      return exact.largest_min_d2();
+    }
+  };
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <elecPoint.hpp>
+
+/* Size of the stack buffers for the kernel coefficients. */
+#define elecTAYLOR_BUFFER_SIZE 64
+
+/*
+ * Cartesian Taylor expansions of the 1/r kernel used by elec::V (and
+ * of its gradient, elec::E) for charges lying in the plane. Terms are
+ * indexed by a multi-index k = (i,j), stored by increasing degree
+ * i+j. This is shared by the tree-based field engines.
+ */
+
+namespace elec {
+  namespace taylor {
+
+    /**
+     * Number of terms up to degree order.
+     */
+    inline unsigned int size(unsigned int order) {
+      return (order+1)*(order+2)/2;
+    }
+
+    inline unsigned int index(unsigned int i, unsigned int j) {
+      unsigned int n = i+j;
+      return n*(n+1)/2 + j;
+    }
+
+    /**
+     * Adds q*(d.x^i)*(d.y^j) to m[index(i,j)], where d is the position
+     * of the charge relative to the expansion center.
+     */
+    inline void add_moments(const Point& d, double q, unsigned int order, double* m) {
+      double px = q;
+      for(unsigned int i = 0; i <= order; ++i) {
+	double pxy = px;
+	for(unsigned int j = 0; i+j <= order; ++j) {
+	  m[index(i,j)] += pxy;
+	  pxy *= d.y;
+	}
+	px *= d.x;
+      }
+    }
+
+    /**
+     * Computes a[index(i,j)] = 1/(i!j!) d^(i+j)/(dy1^i dy2^j) 1/|x-y|
+     * taken at y=c, for i+j <= order, where R = x-c. This is the
+     * recurrence of Duan and Krasny for the Coulomb kernel.
+     */
+    inline void coulomb(const Point& R, unsigned int order, double* a) {
+      double r2  = R*R;
+      double ir2 = 1/r2;
+      a[0] = std::sqrt(ir2);
+      for(unsigned int n = 1; n <= order; ++n) {
+	double c1 = (2*n-1.0)/n*ir2;
+	double c2 = (n-1.0)/n*ir2;
+	for(unsigned int j = 0; j <= n; ++j) {
+	  unsigned int i = n-j;
+	  double res = 0;
+	  if(i >= 1) res += c1*R.x*a[index(i-1,j)];
+	  if(j >= 1) res += c1*R.y*a[index(i,j-1)];
+	  if(i >= 2) res -= c2*a[index(i-2,j)];
+	  if(j >= 2) res -= c2*a[index(i,j-2)];
+	  a[index(i,j)] = res;
+	}
+      }
+    }
+
+    /**
+     * Table of binomial coefficients, binomial[n*(n+1)/2+k] = C(n,k).
+     */
+    inline std::vector<double> binomials(unsigned int order) {
+      std::vector<double> res(size(order));
+      for(unsigned int n = 0; n <= order; ++n) {
+	res[n*(n+1)/2]   = 1;
+	res[n*(n+1)/2+n] = 1;
+	for(unsigned int k = 1; k < n; ++k)
+	  res[n*(n+1)/2+k] = res[(n-1)*n/2+k-1] + res[(n-1)*n/2+k];
+      }
+      return res;
+    }
+
+    /**
+     * Fills p[index(i,j)] = d.x^i d.y^j, for i+j <= order.
+     */
+    inline void powers(const Point& d, unsigned int order, double* p) {
+      double px = 1;
+      for(unsigned int i = 0; i <= order; ++i) {
+	double pxy = px;
+	for(unsigned int j = 0; i+j <= order; ++j) {
+	  p[index(i,j)] = pxy;
+	  pxy *= d.y;
+	}
+	px *= d.x;
+      }
+    }
+
+    /**
+     * From the coefficients a (computed up to order+1) and the
+     * moments m (up to order), this accumulates the potential and the
+     * field (i.e. minus the gradient of the potential w.r.t. x).
+     */
+    inline void evaluate(const double* a, const double* m, unsigned int order,
+			 Point& e, double& v) {
+      for(unsigned int n = 0; n <= order; ++n)
+	for(unsigned int j = 0; j <= n; ++j) {
+	  unsigned int i  = n-j;
+	  double       mk = m[index(i,j)];
+	  v   += a[index(i,  j  )]*mk;
+	  e.x += (i+1)*a[index(i+1,j  )]*mk;
+	  e.y += (j+1)*a[index(i,  j+1)]*mk;
+	}
+    }
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+namespace elec {
+
+  /**
+   * A fixed set of threads running parallel loops. The thread calling
+   * run takes part in the loop, so that a pool of n threads starts n-1
+   * workers. The tasks of a loop must be independent; the way they
+   * are distributed over the threads is not deterministic.
+   */
+  class ThreadPool {
+  private:
+
+    std::vector<std::thread>         workers;
+    std::mutex                       mutex;
+    std::condition_variable          start, done;
+    std::function<void(std::size_t)> task;
+    std::size_t                      nb_tasks;
+    std::size_t                      next;     // first task not taken yet.
+    std::size_t                      nb_done;
+    unsigned int                     nb_busy;  // workers within the current loop.
+    unsigned long                    loop;     // identifies the current loop.
+    bool                             stop;
+
+    /* Runs tasks of the current loop until there is none left. */
+    void work(std::unique_lock<std::mutex>& lock) {
+      while(next < nb_tasks) {
+	std::size_t t = next++;
+	lock.unlock();
+	task(t);
+	lock.lock();
+	if(++nb_done == nb_tasks)
+	  done.notify_all();
+      }
+    }
+
+    void worker() {
+      std::unique_lock<std::mutex> lock(mutex);
+      unsigned long last = loop;
+      while(true) {
+	start.wait(lock, [this, last]() {return stop || loop != last;});
+	if(stop)
+	  return;
+	last = loop;
+	++nb_busy;
+	work(lock);
+	if(--nb_busy == 0)
+	  done.notify_all();
+      }
+    }
+
+  public:
+
+    ThreadPool(unsigned int nb_threads)
+      : workers(), mutex(), start(), done(), task(),
+	nb_tasks(0), next(0), nb_done(0), nb_busy(0), loop(0), stop(false) {
+      for(unsigned int i = 1; i < nb_threads; ++i)
+	workers.push_back(std::thread([this]() {this->worker();}));
+    }
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	stop = true;
+      }
+      start.notify_all();
+      for(auto& w : workers)
+	w.join();
+    }
+
+    unsigned int size() const {return workers.size() + 1;}
+
+    /**
+     * Calls fn(0), ..., fn(n-1) in parallel, and returns when all of
+     * them are done.
+     */
+    void run(std::size_t n, const std::function<void(std::size_t)>& fn) {
+      std::unique_lock<std::mutex> lock(mutex);
+      task     = fn;
+      nb_tasks = n;
+      next     = 0;
+      nb_done  = 0;
+      ++loop;
+      start.notify_all();
+      work(lock);
+      done.wait(lock, [this]() {return nb_done == nb_tasks && nb_busy == 0;});
+      task = nullptr;
+    }
+  };
+}
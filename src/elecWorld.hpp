@@ -5,100 +5,592 @@
 #include <iterator>
 #include <iostream>
 #include <stdexcept>
+#include <memory>
+#include <thread>
+#include <functional>
 
 #include <elecArea.hpp>
 #include <elecPoint.hpp>
 #include <elecParticle.hpp>
+#include <elecParticles.hpp>
 #include <elecDipole.hpp>
+#include <elecField.hpp>
+#include <elecQuadtree.hpp>
+#include <elecFMM.hpp>
+#include <elecGrid.hpp>
+#include <elecMesh.hpp>
+#include <elecThreads.hpp>
+#include <elecRandom.hpp>
+#include <elecNeighbours.hpp>
+#include <elecCompiled.hpp>
+#include <elecRaster.hpp>
 
 #include <ccmpl.hpp>
 
 namespace elec {
-  
-  class World {
+
+  /**
+   * The motions of the electrons during a move, dipole transfers
+   * included.
+   */
+  struct MoveStats {
+    std::size_t nb_moved           = 0;
+    double      total_displacement = 0;
+    double      max_displacement   = 0;
+  };
+
+  inline std::ostream& operator<<(std::ostream& os,
+				  const MoveStats& stats) {
+    os << stats.nb_moved << " moved, displacement: total " << stats.total_displacement
+       << ", max " << stats.max_displacement;
+    return os;
+  }
+
+  /**
+   * The stopping criteria of World::run. The world has converged when
+   * the enabled criteria hold for window consecutive moves, the
+   * potential being checked last, since it is the expensive one. The
+   * counts are taken before the first move and then every window
+   * moves, the change being the one since the previous counts: when
+   * they are enabled, the convergence is only checked at these moves.
+   * A run thus takes at least window moves.
+   */
+  struct Convergence {
+    double               total_displacement = 0;  // largest total displacement per move, 0 to ignore.
+    double               max_displacement   = 0;  // largest displacement per move, 0 to ignore.
+    double               potential_spread   = 0;  // largest standard deviation of V at the electrons in a region, 0 to ignore.
+    int                  count_change       = -1; // largest change of the electrons in a region over the window, -1 to ignore.
+    std::vector<AreaRef> regions;                 // of the counts and the potentials, the areas of the world if empty.
+    unsigned int         window             = 10;
+    unsigned int         max_steps          = 10000;
+  };
+
+  /**
+   * The simulated world. The positions of the particles are stored
+   * as Real (see basic_particles), while all the computations on the
+   * areas and the field engines use Point. World uses double.
+   */
+  template<typename Real>
+  class basic_world {
     std::vector<std::pair<elec::AreaRef, unsigned int>> areas;
     AreaSet all;
+    CompiledArea compiled;
+    RasterArea raster;
+    double raster_resolution;
+    bool compiled_dirty;
     Wall wall;
-    std::vector<elec::Point> electrons;
-    std::vector<elec::Point> protons;
+    basic_particles<Real> electrons;
+    basic_particles<Real> protons;
     std::vector<elec::Dipole> dipoles;
+    std::vector<unsigned int> transfers; // per dipole, in the last move.
     ccmpl::chart::Limits2d limits2d;
     bool limits2d_computed;
+    FieldRef field;
+    bool field_dirty;
+    FieldRef proton_field;
+    bool proton_field_dirty;
+    bool incremental_field;
+    unsigned int nb_threads;
+    std::unique_ptr<ThreadPool> pool;
+    NeighbourGrid neighbours;
+    bool neighbours_dirty;
+    double near_reach;
+    bool parallel_move;
+    double tile_size; // of the tiled parallel move, 0 if off.
+
+    std::uint64_t seed;       // the keys of the draws (see set_seed).
+    std::uint32_t step;
+    std::uint64_t nb_streams; // the draws out of the moves of the electrons.
+
+    MoveStats                  last_move;
+
+    unsigned int               sleep_steps; // see set_sleep, 0 if off.
+    std::vector<unsigned int>  still;       // moves spent within elecSLEEP_RADIUS of the anchor.
+    std::vector<Point>         anchor;      // where the electron was when it started to stay.
+    std::vector<unsigned char> asleep;
+    std::vector<Point>         sleep_field; // when it fell asleep.
+    std::size_t                nb_sleeping;
+
+    /* The work space of the motion of an electron (see move). */
+    struct Motion {
+      std::vector<Point>  candidates;
+      std::vector<double> near_xs, near_ys;
+      Point               near_center;
+      double              near_radius = 0;
+      std::vector<Point>  moved_from, moved_to; // the motions which are not in the grid yet (see move_tiled).
+    };
+    Motion motion; // the one of the sequential moves.
     
-    void noisify(Point& e) {
-      Point p;
-      unsigned int nb = 0;
-      do  {
-        p = shake(e,
-		  elecNOISE_RADIUS_MAX,
-		  elecNOISE_RADIUS_MIN*elecNOISE_RADIUS_MIN,
-		  elecNOISE_RADIUS_MAX*elecNOISE_RADIUS_MAX);
-	++nb;
+    void update_field() {
+      if(field_dirty) {
+	field->build(charges(!proton_field));
+	field_dirty = false;
       }
-      while(!(all.in(p)) && nb < elecNOISE_NB_TRIES_INSIDE);
-      
-      if(nb < elecNOISE_NB_TRIES_INSIDE)
-	e = p;
     }
 
-  public:
+    void update_proton_field() {
+      if(proton_field_dirty) {
+	proton_field->build(proton_charges());
+	proton_field_dirty = false;
+      }
+    }
 
-    World() : areas(), all(), wall(20), electrons(), protons(),
-	      limits2d(), limits2d_computed(false) {}
+    bool follows_electrons() const {
+      return incremental_field && field && field->incremental();
+    }
 
+    /* Tells the electron index and the field engine that electron i
+       is now at to. */
+    void electron_moved(std::size_t i, const Point& to) {
+      if(!neighbours_dirty)
+	neighbours.update(i, to);
+      field_moved(i, to);
+    }
 
-    std::pair<Point,double> closest_electron_d2(const Point& p, const Point& exclude) {
-      std::pair<Point,double> res = {Point(0,0),std::numeric_limits<double>::max()};
-      double d;
-      for(auto& e_pos : electrons) 
-	if((e_pos != exclude) && ((d = d2(e_pos,p)) < res.second))
-	  res = {e_pos,d};
+    /* Tells the field engine only. */
+    void field_moved(std::size_t i, const Point& to) {
+      if(follows_electrons() && !field_dirty)
+	if(!field->update((proton_field ? 0 : protons.size()) + i, to))
+	  field_dirty = true;
+    }
+
+    void electrons_changed() {
+      field_dirty      = true;
+      neighbours_dirty = true;
+    }
+
+    void protons_changed() {
+      field_dirty        = true;
+      proton_field_dirty = true;
+    }
+
+    /* The cells are about the largest distance required between
+       electrons, so that a nearest neighbour is usually found in the
+       cells around the query. */
+    void update_neighbours() {
+      if(neighbours_dirty) {
+	double size = std::sqrt(all.largest_min_d2());
+	if(size == 0)
+	  size = elecMAX_VARIATION;
+	std::pair<Point,Point> bbox = {Point(-1,-1),Point(1,1)};
+	if(!all.areas.empty())
+	  bbox = all.bbox();
+	neighbours.build(bbox.first, bbox.second, size, electrons.cbegin(), electrons.cend());
+	neighbours_dirty = false;
+	near_reach       = 2*size;
+      }
+    }
+
+    /* The areas, compiled (and tabulated, see set_raster) for the queries. */
+    const Area& geometry() {
+      if(compiled_dirty) {
+	compiled.compile(std::make_shared<AreaSet>(all));
+	if(raster_resolution > 0)
+	  raster.build(compiled, raster_resolution);
+	compiled_dirty = false;
+      }
+      if(raster_resolution > 0)
+	return raster;
+      return compiled;
+    }
+
+    /* The generator of the draws which are not the ones of an
+       electron in a move (the creation of particles, move(e,E)). Their
+       indices do not collide with the ones of the electrons. */
+    Philox stream() {
+      return Philox(seed, step, (std::uint64_t(1) << 63) + nb_streams++);
+    }
+
+    /* Accounts for a motion in the statistics of the move. */
+    void record(const Point& from, const Point& to) {
+      double dist = d(from, to);
+      ++last_move.nb_moved;
+      last_move.total_displacement += dist;
+      last_move.max_displacement    = std::max(last_move.max_displacement, dist);
+    }
+
+    /* The regions of a convergence test. */
+    std::vector<AreaRef> regions_of(const Convergence& c) const {
+      if(!c.regions.empty())
+	return c.regions;
+      std::vector<AreaRef> res;
+      for(auto& area : areas) res.push_back(area.first);
       return res;
     }
 
-    void move(Point& e, const Point& E) {
-      auto scored = wall(e,e-E*all.mobility(e),
-			 [this,e](const Point& p, std::pair<Point,double>& sc) -> bool {
-			   if(this->all.in(p)) {
-			     sc = this->closest_electron_d2(p,e);
-			     return true;
-			   }
-			   else
-			     return false;
-			 });
-	
+    /* The number of electrons in each region. */
+    std::vector<unsigned int> counts(const std::vector<AreaRef>& regions) const {
+      std::vector<unsigned int> res(regions.size(), 0);
+      for(auto e : electrons)
+	for(std::size_t r = 0; r < regions.size(); ++r)
+	  if(regions[r]->in(e))
+	    ++res[r];
+      return res;
+    }
+
+    /* The largest standard deviation of the potential at the electrons
+       of a region. */
+    double potential_spread(const std::vector<AreaRef>& regions) {
+      std::vector<Point>  at(electrons.begin(), electrons.end());
+      std::vector<double> v(at.size());
+      V_batch(at.data(), v.data(), at.size());
+      double res = 0;
+      for(auto& region : regions) {
+	double sum = 0, sum2 = 0;
+	std::size_t nb = 0;
+	for(std::size_t i = 0; i < at.size(); ++i)
+	  if(region->in(at[i])) {
+	    sum  += v[i];
+	    sum2 += v[i]*v[i];
+	    ++nb;
+	  }
+	if(nb > 1)
+	  res = std::max(res, std::sqrt(std::max(0., sum2/nb - (sum/nb)*(sum/nb))));
+      }
+      return res;
+    }
+
+    /* Sizes the sleeping state to the electrons, all awake if some were
+       added. */
+    void update_sleep() {
+      if(still.size() != electrons.size()) {
+	still.assign(electrons.size(), 0);
+	anchor.assign(electrons.begin(), electrons.end());
+	asleep.assign(electrons.size(), 0);
+	sleep_field.assign(electrons.size(), Point(0,0));
+	nb_sleeping = 0;
+      }
+    }
+
+    /* All awake, the state being built again at the next move. */
+    void reset_sleep() {
+      still.clear();
+      anchor.clear();
+      asleep.clear();
+      sleep_field.clear();
+      nb_sleeping = 0;
+    }
+
+    void wake(std::size_t i) {
+      still[i] = 0;
+      if(asleep[i]) {
+	asleep[i] = 0;
+	--nb_sleeping;
+      }
+    }
+
+    /* Wakes the electrons up whose motion may depend on an electron
+       at p, i.e. the ones gathering it (see gather_near). */
+    void wake_around(const Point& p) {
+      double radius = elecMAX_VARIATION + elecNOISE_RADIUS_MAX + near_reach;
+      neighbours.visit(p, radius, [this](unsigned int i) {this->wake(i);});
+    }
+
+    /* Wakes the sleeping electrons up which may move into the room
+       freed at p, i.e. the ones within a motion of half the minimal
+       distance from p. The awake ones keep counting their still moves,
+       so that the jitter of the electrons around does not keep them
+       from falling asleep. */
+    void wake_freed(const Point& p) {
+      double radius = elecMAX_VARIATION + elecNOISE_RADIUS_MAX + .25*near_reach;
+      neighbours.visit(p, radius, [this](unsigned int i) {
+	  if(this->asleep[i])
+	    this->wake(i);
+	});
+    }
+
+    /* Electron i has just moved to p (or stayed there), at field f.
+       Within elecSLEEP_RADIUS of its anchor, the move counts as still,
+       and it falls asleep after sleep_steps of them. Otherwise, p
+       becomes its anchor, and the sleeping electrons next to the old
+       one are woken up. The settled electrons keep jittering by about
+       elecMAX_VARIATION, so that an exact match would never hold. */
+    void settle(std::size_t i, const Point& p, const Point& f) {
+      if(d2(p, anchor[i]) > elecSLEEP_RADIUS*elecSLEEP_RADIUS) {
+	wake_freed(anchor[i]);
+	anchor[i] = p;
+	still[i]  = 0;
+      }
+      else if(++still[i] >= sleep_steps) {
+	asleep[i]      = 1;
+	sleep_field[i] = f;
+	++nb_sleeping;
+      }
+    }
+
+    /* The motion toward the wall target, up to its sign, of an
+       electron whose field times mobility is v (see Wall::frame). */
+    static Point wall_step(const Point& v) {
+      double n2 = v*v;
+      if(n2 < elecMAX_VARIATION*elecMAX_VARIATION)
+	return v;
+      return v*(elecMAX_VARIATION/std::sqrt(n2));
+    }
+
+    /* Wakes the sleeping electrons up whose field changed enough to
+       shift their wall target (see Wall::motions) by elecWAKE_SHIFT.
+       Each one is checked every sleep_steps moves, so that the cost of
+       the check is spread over the moves. */
+    void check_sleeping(const Area& area) {
+      std::vector<std::size_t> due;
+      std::vector<Point>       at, field_at;
+      for(std::size_t i = 0; i < electrons.size(); ++i)
+	if(asleep[i] && (step + i) % sleep_steps == 0) {
+	  due.push_back(i);
+	  at.push_back(electrons[i]);
+	}
+      field_at.resize(at.size());
+      E_batch(at.data(), field_at.data(), at.size());
+      for(std::size_t k = 0; k < due.size(); ++k) {
+	double mobility = area.mobility(at[k]);
+	Point  shift    = wall_step(field_at[k]*mobility) - wall_step(sleep_field[due[k]]*mobility);
+	if(shift*shift > elecWAKE_SHIFT*elecWAKE_SHIFT)
+	  wake(due[k]);
+      }
+    }
+
+    /* Gathers the electrons around e (except e) which may be the
+       closest ones of the points considered when e moves: the wall
+       candidates, e itself and their noisy versions. The neighbours
+       must be up to date. */
+    void gather_near(const Point& e, Motion& m) const {
+      m.near_center = e;
+      m.near_radius = elecMAX_VARIATION + elecNOISE_RADIUS_MAX + near_reach;
+      m.near_xs.clear();
+      m.near_ys.clear();
+      neighbours.gather(e, m.near_radius, e, m.near_xs, m.near_ys);
+      double r2 = m.near_radius*m.near_radius;
+      for(std::size_t k = 0; k < m.moved_from.size(); ++k) {
+	if(d2(m.moved_from[k], e) <= r2)
+	  for(std::size_t j = 0; j < m.near_xs.size(); ++j)
+	    if(Point(m.near_xs[j], m.near_ys[j]) == m.moved_from[k]) {
+	      m.near_xs[j] = m.near_xs.back(); m.near_xs.pop_back();
+	      m.near_ys[j] = m.near_ys.back(); m.near_ys.pop_back();
+	      break;
+	    }
+	if(d2(m.moved_to[k], e) <= r2) {
+	  m.near_xs.push_back(m.moved_to[k].x);
+	  m.near_ys.push_back(m.moved_to[k].y);
+	}
+      }
+    }
+
+    /* The closest electron to p, not located at m.near_center, the
+       motions of m overriding the grid. */
+    std::pair<Point,double> closest_far(const Point& p, const Motion& m) const {
+      if(m.moved_from.empty())
+	return neighbours.closest(p, m.near_center);
+      auto res = neighbours.closest(p, m.near_center, [&m](const Point& q) {
+	  return std::find(m.moved_from.begin(), m.moved_from.end(), q) != m.moved_from.end();
+	});
+      for(auto& q : m.moved_to) {
+	double dd = d2(q, p);
+	if(q != m.near_center && dd < res.second)
+	  res = {q, dd};
+      }
+      return res;
+    }
+
+    /* Sets res[k] to closest_electron_d2(at[k],m.near_center), for k < n
+       (n <= elecWALL_CHUNK). It is computed from the gathered
+       electrons when they are sure to contain the closest one, i.e.
+       when it is closer than the border of the gathering disk. */
+    void closest_near(const Point* at, std::size_t n, std::pair<Point,double>* res, const Motion& m) const {
+      std::size_t idx[elecWALL_CHUNK];
+      double      dd [elecWALL_CHUNK];
+      kernel::closest_batch(m.near_xs.data(), m.near_ys.data(), m.near_xs.size(), at, idx, dd, n);
+      for(std::size_t k = 0; k < n; ++k) {
+	double reach = m.near_radius*(1-1e-9) - d(at[k],m.near_center);
+	if(idx[k] < m.near_xs.size() && reach > 0 && dd[k] <= reach*reach)
+	  res[k] = {Point(m.near_xs[idx[k]], m.near_ys[idx[k]]), dd[k]};
+	else
+	  res[k] = closest_far(at[k], m);
+      }
+    }
+
+    void update_fields() {
+      if(proton_field) update_proton_field();
+      if(field)        update_field();
+    }
+
+    /* E_batch, once the engines are up to date. */
+    void fill_E_batch(const Point* at, Point* out, std::size_t n) const {
+      std::vector<Point> buf(n, Point(0,0));
+      if(proton_field)
+	proton_field->E_batch(at, out, n);
+      else
+	std::fill(out, out+n, Point(0,0));
+      if(field)
+	field->E_batch(at, buf.data(), n);
+      else {
+	if(!proton_field)
+	  elec::E_batch(protons, at, out, n);
+	elec::E_batch(electrons, at, buf.data(), n);
+	for(std::size_t i = 0; i < n; ++i)
+	  buf[i] = elec::E(dipoles.begin(), dipoles.end(), at[i]) - buf[i];
+      }
+      for(std::size_t i = 0; i < n; ++i)
+	out[i] = elecELEMENTARY_CHARGE*(out[i] + buf[i]);
+    }
+
+    /* V_batch, once the engines are up to date. */
+    void fill_V_batch(const Point* at, double* out, std::size_t n) const {
+      std::vector<double> buf(n, 0);
+      if(proton_field)
+	proton_field->V_batch(at, out, n);
+      else
+	std::fill(out, out+n, 0);
+      if(field)
+	field->V_batch(at, buf.data(), n);
+      else {
+	if(!proton_field)
+	  elec::V_batch(protons, at, out, n);
+	elec::V_batch(electrons, at, buf.data(), n);
+	for(std::size_t i = 0; i < n; ++i)
+	  buf[i] = elec::V(dipoles.begin(), dipoles.end(), at[i]) - buf[i];
+      }
+      for(std::size_t i = 0; i < n; ++i)
+	out[i] = elecELEMENTARY_CHARGE*(out[i] + buf[i]);
+    }
+
+    /* Calls fn(0), ..., fn(n-1), in parallel on the thread pool. */
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)>& fn) {
+      if(!pool) {
+	unsigned int nb = nb_threads != 0 ? nb_threads : std::thread::hardware_concurrency();
+	pool.reset(new ThreadPool(std::max(1u, nb)));
+      }
+      if(pool->size() == 1 || n < 2)
+	for(std::size_t i = 0; i < n; ++i)
+	  fn(i);
+      else
+	pool->run(n, fn);
+    }
+
+    /* Applies the dipoles to the electrons, after a move. The electrons
+       close to the positive pole are found from the neighbours grid,
+       and transferred in index order, as a scan of the electrons
+       would. */
+    void transfer_dipoles() {
+      transfers.assign(dipoles.size(), 0);
+      if(!follows_electrons())
+	field_dirty = true;
+      if(dipoles.empty())
+	return;
+      update_neighbours();
+      std::vector<unsigned int> close;
+      for(std::size_t k = 0; k < dipoles.size(); ++k) {
+	auto& d = dipoles[k];
+	close.clear();
+	neighbours.visit(d.pos, std::sqrt(d.r2)*(1+1e-9), [&close](unsigned int i) {close.push_back(i);});
+	std::sort(close.begin(), close.end());
+	for(auto i : close) {
+	  Point e = electrons[i];
+	  Point p = e;
+	  d.transfer(p);
+	  if(p != e) {
+	    electrons[i] = p;
+	    electron_moved(i,electrons[i]);
+	    record(e, p);
+	    ++transfers[k];
+	    if(still.size() == electrons.size()) {
+	      wake_around(e);
+	      wake_around(p);
+	      anchor[i] = p;
+	    }
+	  }
+	}
+      }
+    }
+
+    /* Moves e at random around itself, inside the areas. The signed
+       distance tells when the whole annulus of the noise is inside
+       (no test is needed) or outside (no point can be found). Otherwise,
+       the points are drawn on the inner side of the tangent to the
+       border, which holds the part of the annulus inside the areas
+       when the gradient is known, and tested. */
+    template<typename Rng>
+    void noisify(const Area& area, Point& e, Rng& rng) const {
+      double reach = elecNOISE_RADIUS_MAX + elecNOISE_DISTANCE_SLACK;
+      Point  g;
+      double d = area.distance(e, reach, g);
+      if(d >= reach)
+	return;
+      if(d <= -reach) {
+	e = shake(e,
+		  elecNOISE_RADIUS_MAX,
+		  elecNOISE_RADIUS_MIN*elecNOISE_RADIUS_MIN,
+		  elecNOISE_RADIUS_MAX*elecNOISE_RADIUS_MAX,
+		  rng);
+	return;
+      }
+      bool tangent = g.x != 0 || g.y != 0;
+      Point p;
+      for(unsigned int nb = 0; nb < elecNOISE_NB_TRIES_INSIDE; ++nb) {
+	if(!tangent)
+	  p = shake(e,
+		    elecNOISE_RADIUS_MAX,
+		    elecNOISE_RADIUS_MIN*elecNOISE_RADIUS_MIN,
+		    elecNOISE_RADIUS_MAX*elecNOISE_RADIUS_MAX,
+		    rng);
+	else if(!shake_clipped(e, elecNOISE_RADIUS_MIN, elecNOISE_RADIUS_MAX, g, elecNOISE_DISTANCE_SLACK - d, p, rng))
+	  return;
+	if(area.in(p)) {
+	  e = p;
+	  return;
+	}
+      }
+    }
+
+    /* Moves e, in the field E, within the given areas. The electrons
+       around are the ones of the neighbours grid, which must be up to
+       date, and the random numbers are drawn from rng. m is the work
+       space. */
+    template<typename Rng>
+    void move(Point& e, const Point& E, const Area& area, Motion& m, Rng& rng) const {
       bool ee_found = false;
       Point ee;
-      double min_d2_e = 0;
+      Properties at_e = area.query(e);
+      double min_d2_e = at_e.min_d2;
       std::pair<Point,double> closest_d2 = {Point(0,0),0};
 
-      // Let us find the first fitting point, if any
-      if(!ee_found)  {
-	min_d2_e = all.min_d2(e);
-	for(auto& p_sc : scored)
-	  if(p_sc.second.second > min_d2_e) {
-	    ee = p_sc.first;
+      // Let us find the first fitting point, if any, while keeping
+      // the best one seen so far (the first of the best ones). The
+      // candidates are scored by chunks, from the electrons gathered
+      // around e.
+      wall.motions(e, e-E*at_e.mobility, m.candidates);
+      gather_near(e, m);
+      bool best_found = false;
+      std::pair<Point,std::pair<Point,double>> best;
+      std::pair<Point,double> sc[elecWALL_CHUNK];
+      for(std::size_t b = 0; b < m.candidates.size() && !ee_found; b += elecWALL_CHUNK) {
+	std::size_t len = std::min<std::size_t>(elecWALL_CHUNK, m.candidates.size()-b);
+	closest_near(m.candidates.data()+b, len, sc, m);
+	for(std::size_t k = 0; k < len; ++k) {
+	  const Point& p = m.candidates[b+k];
+	  if(!area.in(p))
+	    continue;
+	  if(sc[k].second > min_d2_e) {
+	    ee       = p;
 	    ee_found = true;
 	    break;
 	  }
+	  if(!best_found || sc[k].second > best.second.second) {
+	    best       = {p,sc[k]};
+	    best_found = true;
+	  }
+	}
       }
-     
 
       // No fitting point, let us move toward the best one. 
       
       if(!ee_found)  {
-	closest_d2 = closest_electron_d2(e,e);
-	if(scored.size() > 0) {
-	  auto m = std::max_element(scored.begin(), scored.end(), 
-				    [](const std::pair<Point,std::pair<Point,double>>& p1,
-				       const std::pair<Point,std::pair<Point,double>>& p2) -> double {return p1.second.second < p2.second.second;});
-	  if(m->second.second > closest_d2.second) {
-	    auto d1 = m->second.first - m->first;
-	    auto d2 = closest_d2.first - e;
-	    if(d1*d2 > 0)  {// the closest is not toward the current motion
-	      ee       = m->first;
-	      ee_found = true;
-	    }
+	closest_near(&e, 1, &closest_d2, m);
+	if(best_found && best.second.second > closest_d2.second) {
+	  auto d1 = best.second.first - best.first;
+	  auto d2 = closest_d2.first - e;
+	  if(d1*d2 > 0)  {// the closest is not toward the current motion
+	    ee       = best.first;
+	    ee_found = true;
 	  }
 	}
       }
@@ -111,9 +603,10 @@ namespace elec {
       // Let us noisify the position
       for(unsigned i=0; i< elecNB_NOISE_TRIES; ++i) {
 	auto p =  ee;
-	noisify(p);
-	if(all.in(p)) {
-	  auto closest_p = closest_electron_d2(p,e);
+	noisify(area, p, rng);
+	if(area.in(p)) {
+	  std::pair<Point,double> closest_p;
+	  closest_near(&p, 1, &closest_p, m);
 	  if(closest_p.second > closest_d2.second) {
 	    auto d1 = closest_p.first - p;
 	    auto d2 = closest_d2.first - e;
@@ -129,73 +622,690 @@ namespace elec {
       
     }
 
+    /* The smallest tiles such that the motions of the electrons of a
+       tile never gather the electrons moved by another tile of the
+       same colour: the gathering radius and the largest motion, plus
+       a cell on each side and one against roundings. */
+    double min_tile_size() const {
+      double motion = elecMAX_VARIATION + elecNOISE_RADIUS_MAX;
+      return 2*motion + near_reach + 3*neighbours.cell();
+    }
+
+    /* The tiled move (see set_tiled_move). The tiles are the ones of
+       the positions at the beginning of the move, clamped into the
+       neighbours grid as the grid does. The order of the colours is
+       drawn at random at each move, so that no side of the tiles
+       always moves first. Within a tile, the electrons move in the
+       order of their indices, as in move(): that order is already a
+       random one with respect to the positions, and drawing it again
+       at each move slows the transients down. The field is computed
+       by the engine at the beginning of each colour, and corrected
+       within a tile as move() does within a block: it is the field at
+       the beginning of the colour with direct summation or an
+       incremental engine, and the one at the beginning of the move
+       otherwise, since the engine is not rebuilt during the move. The
+       grid is only read during a colour, each tile overriding it with
+       its own motions (see Motion), and it is updated after the
+       colour. */
+    void move_tiled() {
+      const Area& area = geometry();
+      update_neighbours();
+      std::size_t n = electrons.size();
+      std::vector<Point> at(electrons.begin(), electrons.end());
+
+      double size = std::max(tile_size, min_tile_size());
+      auto   bb   = neighbours.bbox();
+      int    ntx  = std::max(1, (int)std::ceil((bb.second.x - bb.first.x)/size));
+      int    nty  = std::max(1, (int)std::ceil((bb.second.y - bb.first.y)/size));
+      std::vector<std::vector<std::size_t>> tiles(ntx*nty);
+      for(std::size_t i = 0; i < n; ++i) {
+	Point q  = neighbours.clamp(at[i]);
+	int   tx = std::min(ntx-1, (int)((q.x - bb.first.x)/size));
+	int   ty = std::min(nty-1, (int)((q.y - bb.first.y)/size));
+	tiles[ty*ntx+tx].push_back(i);
+      }
+      std::vector<std::size_t> colours[4];
+      for(int ty = 0; ty < nty; ++ty)
+	for(int tx = 0; tx < ntx; ++tx)
+	  if(!tiles[ty*ntx+tx].empty())
+	    colours[2*(ty%2) + tx%2].push_back(ty*ntx+tx);
+      Philox rng = stream();
+      unsigned int order[4] = {0, 1, 2, 3};
+      for(unsigned int k = 4; k > 1; --k)
+	std::swap(order[k-1], order[rng.bits() % k]);
+
+      bool live = !field || follows_electrons();
+      std::vector<Point> field_at(n);
+      std::vector<char> moved(n, 0);
+      for(auto c : order) {
+	const std::vector<std::size_t>& colour = colours[c];
+	update_fields();
+	parallel_for(colour.size(), [this, &at, &field_at, &tiles, &colour](std::size_t t) {
+	    const std::vector<std::size_t>& tile = tiles[colour[t]];
+	    std::vector<Point> pos(tile.size()), out(tile.size());
+	    for(std::size_t k = 0; k < tile.size(); ++k) pos[k] = at[tile[k]];
+	    this->fill_E_batch(pos.data(), out.data(), tile.size());
+	    for(std::size_t k = 0; k < tile.size(); ++k) field_at[tile[k]] = out[k];
+	  });
+	parallel_for(colour.size(), [this, &area, &at, &field_at, &tiles, &colour, &moved, live](std::size_t t) {
+	    const std::vector<std::size_t>& tile = tiles[colour[t]];
+	    Motion m;
+	    for(std::size_t k = 0; k < tile.size(); ++k) {
+	      std::size_t i = tile[k];
+	      Point e = at[i];
+	      Point f = field_at[i];
+	      if(live)
+		for(std::size_t j = 0; j < k; ++j)
+		  if(moved[tile[j]]) {
+		    Point to = this->electrons[tile[j]];
+		    f -= elecELEMENTARY_CHARGE*(elec::E(to,e) - elec::E(at[tile[j]],e));
+		  }
+	      Philox rng(this->seed, this->step, i);
+	      Point p = e;
+	      this->move(p, f, area, m, rng);
+	      if(p != e) {
+		this->electrons[i] = p;
+		m.moved_from.push_back(e);
+		m.moved_to.push_back(this->electrons[i]);
+		moved[i] = 1;
+	      }
+	    }
+	  });
+	for(auto t : colour)
+	  for(auto i : tiles[t])
+	    if(moved[i]) {
+	      neighbours.update(i, electrons[i]);
+	      field_moved(i, electrons[i]);
+	      record(at[i], electrons[i]);
+	    }
+      }
+      transfer_dipoles();
+      ++step;
+    }
+
+    /* The parallel move (see set_parallel_move). The motions are
+       computed from a snapshot of the positions and all applied, then
+       checked in index order against the new positions. A cancelled
+       motion puts the electron back where it was, possibly too close
+       to an electron whose motion was kept: the motions ending closer
+       to it than allowed, and than its closest electron was, are
+       cancelled in turn, until none is. */
+    void move_jacobi() {
+      const Area& area = geometry();
+      update_neighbours();
+      update_fields();
+      std::size_t n = electrons.size();
+      std::vector<Point> at(electrons.begin(), electrons.end());
+      std::vector<Point> next(n);
+      std::vector<double> expected(n), spacing(n);
+      std::size_t nb_blocks = (n + elecMOVE_BLOCK - 1)/elecMOVE_BLOCK;
+      parallel_for(nb_blocks, [this, &area, &at, &next, &expected, &spacing, n](std::size_t blk) {
+	  std::size_t b   = blk*elecMOVE_BLOCK;
+	  std::size_t len = std::min<std::size_t>(elecMOVE_BLOCK, n-b);
+	  Point field_at[elecMOVE_BLOCK];
+	  this->fill_E_batch(at.data()+b, field_at, len);
+	  Motion m;
+	  for(std::size_t k = b; k < b+len; ++k) {
+	    Philox rng(this->seed, this->step, k);
+	    next[k] = at[k];
+	    this->move(next[k], field_at[k-b], area, m, rng);
+	    if(next[k] != at[k]) {
+	      expected[k] = this->neighbours.closest(next[k], at[k]).second;
+	      spacing[k]  = this->neighbours.closest(at[k], at[k]).second;
+	    }
+	  }
+	});
+
+      for(std::size_t i = 0; i < n; ++i)
+	if(next[i] != at[i]) {
+	  electrons[i] = next[i];
+	  electron_moved(i,electrons[i]);
+	}
+      std::vector<unsigned char> kept(n, 0);
+      std::vector<std::size_t>   back; // the cancelled motions.
+      for(std::size_t i = 0; i < n; ++i)
+	if(next[i] != at[i]) {
+	  double closest = neighbours.closest(next[i], next[i]).second;
+	  if(closest < expected[i] && closest < area.min_d2(next[i])) {
+	    electrons[i] = at[i];
+	    electron_moved(i,electrons[i]);
+	    back.push_back(i);
+	  }
+	  else
+	    kept[i] = 1;
+	}
+      double reach = std::sqrt(area.largest_min_d2());
+      std::vector<unsigned int> close;
+      while(!back.empty()) {
+	Point  r  = at[back.back()];
+	double sr = spacing[back.back()];
+	back.pop_back();
+	close.clear();
+	neighbours.visit(r, reach, [&area, &next, &kept, &close, &r, sr](unsigned int j) {
+	    double dd = d2(next[j], r);
+	    if(kept[j] && dd < sr && dd < area.min_d2(next[j]))
+	      close.push_back(j);
+	  });
+	for(auto j : close) {
+	  electrons[j] = at[j];
+	  electron_moved(j,electrons[j]);
+	  kept[j] = 0;
+	  back.push_back(j);
+	}
+      }
+      for(std::size_t i = 0; i < n; ++i)
+	if(kept[i])
+	  record(at[i], next[i]);
+      transfer_dipoles();
+      ++step;
+    }
+
+  public:
+
+    basic_world() : areas(), all(), compiled(), raster(), raster_resolution(0), compiled_dirty(true), wall(20), electrons(), protons(),
+	      limits2d(), limits2d_computed(false),
+	      field(), field_dirty(true),
+	      proton_field(), proton_field_dirty(true),
+	      incremental_field(false),
+	      nb_threads(0), pool(),
+	      neighbours(), neighbours_dirty(true),
+	      near_reach(0), parallel_move(false), tile_size(0),
+	      seed(std::rand()), step(0), nb_streams(0),
+	      last_move(),
+	      sleep_steps(0), still(), asleep(), sleep_field(), nb_sleeping(0), motion() {}
+
+    /**
+     * Sets the engine used by E and V. A null engine (the default)
+     * means direct summation, which is the reference.
+     */
+    void set_field(FieldRef engine) {
+      field       = engine;
+      field_dirty = true;
+    }
+
+    /**
+     * In incremental mode, an engine which supports it (see
+     * Field::update) follows each electron as soon as it moves, so
+     * that within a move, every electron sees the new positions of the
+     * previous ones, as with direct summation. Otherwise, the engine
+     * is built again after each move, and reflects the positions at
+     * the beginning of the move.
+     */
+    void set_incremental(bool on) {
+      incremental_field = on;
+      field_dirty       = true;
+    }
+
+    /**
+     * Sets an engine dedicated to the protons, which is built once
+     * since protons do not move (see GridField). The other charges are
+     * then handled by the engine set by set_field. A null engine (the
+     * default) puts the protons back with the other charges.
+     */
+    void set_proton_field(FieldRef engine) {
+      proton_field       = engine;
+      proton_field_dirty = true;
+      field_dirty        = true;
+    }
+
+    /**
+     * Compares the proton engine with the direct summation of the
+     * protons, at the given points.
+     */
+    FieldError proton_field_error(const std::vector<Point>& at) {
+      if(!proton_field)
+	return FieldError();
+      update_proton_field();
+      return error(*proton_field, proton_charges(), at);
+    }
+
+    /**
+     * Same as above, at the current positions of the electrons.
+     */
+    FieldError proton_field_error() {
+      return proton_field_error(std::vector<Point>(electrons.begin(), electrons.end()));
+    }
+
+    std::vector<Charge> proton_charges() const {
+      std::vector<Charge> res;
+      res.reserve(protons.size());
+      for(auto p : protons) res.push_back({p, 1});
+      return res;
+    }
+
+    /**
+     * All the charges of the world (protons, electrons and dipole poles).
+     */
+    std::vector<Charge> charges(bool with_protons = true) const {
+      std::vector<Charge> res;
+      res.reserve(protons.size() + electrons.size() + 2*dipoles.size());
+      if(with_protons)
+	for(auto p : protons) res.push_back({p, 1});
+      for(auto e : electrons) res.push_back({e, -1});
+      for(auto& d : dipoles) {
+	res.push_back({d.pos,  d.nb});
+	res.push_back({d.neg, -d.nb});
+      }
+      return res;
+    }
+
+
+    /**
+     * The closest electron to p, not located at exclude, with its
+     * squared distance. It uses a grid of the electrons, updated as
+     * they move.
+     */
+    std::pair<Point,double> closest_electron_d2(const Point& p, const Point& exclude) {
+      update_neighbours();
+      return neighbours.closest(p, exclude);
+    }
+
+    void move(Point& e, const Point& E) {
+      const Area& area = geometry();
+      update_neighbours();
+      Philox rng = stream();
+      move(e, E, area, motion, rng);
+    }
+
     Point E(const Point& pos) {
-      return elecELEMENTARY_CHARGE
-	* (elec::E(  protons.begin(),   protons.end(),   pos)
-	   - elec::E(electrons.begin(), electrons.end(), pos)
-	   + elec::E(dipoles.begin(),   dipoles.end(),   pos));
+      Point res = {0,0};
+      if(proton_field) {
+	update_proton_field();
+	res = proton_field->E(pos);
+      }
+      if(field) {
+	update_field();
+	res += field->E(pos);
+      }
+      else {
+	if(!proton_field)
+	  res += elec::E(protons, pos);
+	res += elec::E(dipoles.begin(), dipoles.end(), pos) - elec::E(electrons, pos);
+      }
+      return elecELEMENTARY_CHARGE*res;
     }
 
     double V(const Point& pos) {
+      double res = 0;
+      if(proton_field) {
+	update_proton_field();
+	res = proton_field->V(pos);
+      }
+      if(field) {
+	update_field();
+	res += field->V(pos);
+      }
+      else {
+	if(!proton_field)
+	  res += elec::V(protons, pos);
+	res += elec::V(dipoles.begin(), dipoles.end(), pos) - elec::V(electrons, pos);
+      }
+      return elecELEMENTARY_CHARGE*res;
+    }
+
+    Point E_direct(const Point& pos) const {
+      return elecELEMENTARY_CHARGE
+	* (elec::E(  protons,                        pos)
+	   - elec::E(electrons,                      pos)
+	   + elec::E(dipoles.begin(),   dipoles.end(), pos));
+    }
+
+    double V_direct(const Point& pos) const {
       return elecELEMENTARY_CHARGE
-	* (elec::V   (protons.begin(),   protons.end(),   pos)
-	   - elec::V (electrons.begin(), electrons.end(), pos)
-	   + elec::V (dipoles.begin(),   dipoles.end(),   pos));
+	* (elec::V   (protons,                        pos)
+	   - elec::V (electrons,                      pos)
+	   + elec::V (dipoles.begin(),   dipoles.end(), pos));
     }
 
+    /**
+     * Moves the electrons, one after the other, in the field E. The
+     * draws of electron i are the ones of Philox(seed, step, i).
+     */
     template<typename Efunc>
     void move(const Efunc& E) {
-      for(auto& e : electrons) move(e,E(e));
-      for(auto& d : dipoles)  d.transfer(electrons.begin(), electrons.end());
+      reset_sleep();
+      last_move = MoveStats();
+      const Area& area = geometry();
+      for(std::size_t i = 0; i < electrons.size(); ++i) {
+	Point e = electrons[i];
+	Point p = e;
+	Philox rng(seed, step, i);
+	update_neighbours();
+	move(p, E(p), area, motion, rng);
+	if(p != e) {
+	  electrons[i] = p;
+	  electron_moved(i,electrons[i]);
+	  record(e, p);
+	}
+      }
+      transfer_dipoles();
+      ++step;
+    }
+
+    /**
+     * Moves the electrons in the field of the world. The field is
+     * computed by E_batch for blocks of elecMOVE_BLOCK electrons. With
+     * direct summation, or an engine in incremental mode, the field of
+     * the electrons already moved in the block is corrected, so that
+     * the result is the one of move(E) with E the world field.
+     * See set_tiled_move and set_parallel_move for the parallel
+     * alternatives, and set_sleep to skip the settled electrons.
+     */
+    void move() {
+      last_move = MoveStats();
+      if(tile_size > 0 || parallel_move)
+	reset_sleep();
+      if(tile_size > 0) {
+	move_tiled();
+	return;
+      }
+      if(parallel_move) {
+	move_jacobi();
+	return;
+      }
+      const Area& area = geometry();
+      bool live  = !field || follows_electrons();
+      bool sleep = sleep_steps > 0;
+      std::vector<std::size_t> active;
+      if(sleep) {
+	update_sleep();
+	update_neighbours();
+	check_sleeping(area);
+	for(std::size_t i = 0; i < electrons.size(); ++i)
+	  if(!asleep[i])
+	    active.push_back(i);
+      }
+      std::size_t nb_active = sleep ? active.size() : electrons.size();
+      std::vector<Point> at, field_at;
+      for(std::size_t b = 0; b < nb_active; b += elecMOVE_BLOCK) {
+	std::size_t len = std::min<std::size_t>(elecMOVE_BLOCK, nb_active-b);
+	at.resize(len);
+	for(std::size_t k = 0; k < len; ++k)
+	  at[k] = electrons[sleep ? active[b+k] : b+k];
+	field_at.resize(len);
+	E_batch(at.data(), field_at.data(), len);
+	for(std::size_t k = 0; k < len; ++k) {
+	  std::size_t i = sleep ? active[b+k] : b+k;
+	  Point e = at[k];
+	  Point f = field_at[k];
+	  if(live)
+	    for(std::size_t j = 0; j < k; ++j) {
+	      Point moved = electrons[sleep ? active[b+j] : b+j];
+	      if(moved != at[j])
+		f -= elecELEMENTARY_CHARGE*(elec::E(moved,e) - elec::E(at[j],e));
+	    }
+	  Point p = e;
+	  Philox rng(seed, step, i);
+	  update_neighbours();
+	  move(p, f, area, motion, rng);
+	  if(p != e) {
+	    electrons[i] = p;
+	    electron_moved(i,electrons[i]);
+	    record(e, p);
+	  }
+	  if(sleep)
+	    settle(i, p, f);
+	}
+      }
+      transfer_dipoles();
+      ++step;
+    }
+
+    /**
+     * The motions of the last move, as residuals of the convergence.
+     */
+    const MoveStats& last_move_stats() const {
+      return last_move;
+    }
+
+    /**
+     * Moves the world until it converges (see Convergence), or for
+     * c.max_steps moves, calling after_move(last_move_stats()) after
+     * each move. Returns the number of moves.
+     */
+    template<typename Fn>
+    unsigned int run(const Convergence& c, const Fn& after_move) {
+      auto regions = regions_of(c);
+      bool enabled = c.total_displacement > 0 || c.max_displacement > 0
+	|| c.potential_spread > 0 || c.count_change >= 0;
+      std::vector<unsigned int> last_counts; // the ones of the previous window.
+      if(c.count_change >= 0)
+	last_counts = counts(regions);
+      unsigned int calm = 0;
+      for(unsigned int s = 1; s <= c.max_steps; ++s) {
+	move();
+	after_move(last_move);
+	bool ok = enabled;
+	if(c.total_displacement > 0 && last_move.total_displacement > c.total_displacement)
+	  ok = false;
+	if(c.max_displacement > 0 && last_move.max_displacement > c.max_displacement)
+	  ok = false;
+	calm = ok ? calm + 1 : 0;
+	if(c.count_change >= 0) {
+	  if(s % c.window != 0)
+	    continue;
+	  auto now = counts(regions);
+	  for(std::size_t r = 0; r < regions.size(); ++r)
+	    if(std::abs((int)now[r] - (int)last_counts[r]) > c.count_change)
+	      calm = 0;
+	  last_counts = now;
+	}
+	if(calm >= c.window) {
+	  if(c.potential_spread > 0 && potential_spread(regions) > c.potential_spread)
+	    calm = 0;
+	  else
+	    return s;
+	}
+      }
+      return c.max_steps;
+    }
+
+    /**
+     * Same as above, without a call after each move (e.g. for batch
+     * jobs, without plots).
+     */
+    unsigned int run(const Convergence& c) {
+      return run(c, [](const MoveStats&) {});
+    }
+
+    /**
+     * Sets out[i] to E(at[i]), for i < n. The direct summation goes
+     * through the sources by tiles (see kernel::E_batch).
+     */
+    void E_batch(const Point* at, Point* out, std::size_t n) {
+      update_fields();
+      fill_E_batch(at, out, n);
+    }
+
+    /**
+     * Sets out[i] to V(at[i]), for i < n.
+     */
+    void V_batch(const Point* at, double* out, std::size_t n) {
+      update_fields();
+      fill_V_batch(at, out, n);
+    }
+
+    /**
+     * In parallel mode, move() moves all the electrons at once, from
+     * the positions at the beginning of the move (Jacobi style)
+     * rather than one after the other (Gauss-Seidel style, the
+     * default). As in every move, each electron draws from its own
+     * random sequence (see set_seed), so the motions do not depend on
+     * the number of threads. Since the electrons do not see each
+     * other's motions, a motion which brings an electron closer to
+     * another one than allowed, and than it expected, is cancelled,
+     * and so are the motions which end too close to the electrons
+     * thus put back.
+     */
+    void set_parallel_move(bool on) {
+      parallel_move = on;
+    }
+
+    /**
+     * Sets the seed of the draws of the world, and starts counting the
+     * moves again. The draws of electron i in the n-th move are the
+     * ones of Philox(seed, n, i), whatever the kind of move and the
+     * number of threads; the particles created at random draw from
+     * other sequences of the same seed. The move count wraps around
+     * after 2^32 moves. The default seed is drawn from std::rand when
+     * the world is built; programs set it from Main::seed.
+     */
+    void set_seed(std::uint64_t s) {
+      seed       = s;
+      step       = 0;
+      nb_streams = 0;
+    }
+
+    /**
+     * With k > 0, an electron which has stayed within elecSLEEP_RADIUS
+     * of a position for k moves falls asleep, and move() skips it: no
+     * field, wall or noise. The other electrons still keep away from
+     * it. It wakes up when a close electron leaves its position the
+     * same way, or is moved by a dipole, or when its field changes
+     * enough to shift its wall target by elecWAKE_SHIFT, which is
+     * checked every k moves. A woken electron
+     * moves again from the next move. This only applies to the
+     * sequential move(). 0 turns it off (the default).
+     */
+    void set_sleep(unsigned int k) {
+      sleep_steps = k;
+      reset_sleep();
+    }
+
+    /**
+     * The number of sleeping electrons (see set_sleep).
+     */
+    std::size_t nb_asleep() const {
+      return nb_sleeping;
+    }
+
+    /**
+     * The number of electrons which move() considers.
+     */
+    std::size_t nb_awake() const {
+      return electrons.size() - nb_sleeping;
+    }
+
+    /**
+     * In tiled mode (size > 0), move() splits the domain into square
+     * tiles of the given size, coloured as a checkerboard of 2x2
+     * colours, and moves the electrons of the tiles of a colour in
+     * parallel, the colours one after the other. Within a tile, the
+     * electrons move one after the other, as in the sequential move,
+     * and see the motions of the previous ones. The order of the
+     * colours is drawn at random at each move. The electrons out of
+     * the tile are the ones at the beginning of the
+     * colour, and so is their field with direct summation or an
+     * incremental engine (the one at the beginning of the move
+     * otherwise). The tiles are enlarged to the size
+     * which keeps the tiles of a colour independent, so the motions
+     * do not depend on the number of threads. Across tiles, the
+     * electrons move in the order of the colours rather than in the
+     * order of their indices, and the sequential dynamics is sensitive
+     * to that order: tiles much larger than the minimal size keep the
+     * statistics of the sequential move, but the tiles of the minimal
+     * size, which give the most parallelism, slow the transients down
+     * by a few percents (see test-005). 0 turns it off (the default).
+     * This mode takes precedence over set_parallel_move.
+     */
+    void set_tiled_move(double size) {
+      tile_size = size;
+    }
+
+    /**
+     * Sets the number of threads used to compute the plots, 0 meaning
+     * all the available cores (the default). The plots are the same
+     * whatever the number of threads.
+     */
+    void set_nb_threads(unsigned int nb) {
+      nb_threads = nb;
+      pool.reset();
+    }
+
+    /**
+     * Tabulates the properties of the areas on cells of the given
+     * size (see RasterArea), 0 meaning no table (the default). This
+     * pays off when the geometry is fixed, since the table is built
+     * again after each +=. The motions are the same either way.
+     */
+    void set_raster(double resolution) {
+      raster_resolution = resolution;
+      compiled_dirty    = true;
     }
 
     unsigned int operator+=(elec::AreaRef area) {
       unsigned int res = areas.size();
       areas.push_back({area,0});
       all += area;
+      compiled_dirty   = true;
+      neighbours_dirty = true;
       return res;
     }
 
-    void add_dipole(const Point& at, double r, double angle,
-		    unsigned int nb) {
+    unsigned int add_dipole(const Point& at, double r, double angle,
+			    unsigned int nb) {
+      unsigned int res = dipoles.size();
       dipoles.push_back(Dipole(at,r,angle,nb));
+      field_dirty = true;
+      return res;
+    }
+
+    /**
+     * The number of electrons transferred by the dipole during the last
+     * move, i.e. the current through it.
+     */
+    unsigned int nb_transferred(unsigned int dipole) const {
+      return dipole < transfers.size() ? transfers[dipole] : 0;
     }
 
     void add_electron(const Point& pos) {
       auto e = std::back_inserter(electrons);
       *(e++) = pos;
+      electrons_changed();
     }
 
     unsigned int add_protons_random(AreaRef a) {
-      auto p = std::back_inserter(protons);
-      return add_particles_random(a,p);
+      protons_changed();
+      auto p   = std::back_inserter(protons);
+      auto rng = stream();
+      return add_particles_random(a,p,rng);
     }
 
     void add_protons_random(AreaRef a,  unsigned int nb) {
-      auto p = std::back_inserter(protons);
-      add_particles_random(a,nb,p);
+      protons_changed();
+      auto p   = std::back_inserter(protons);
+      auto rng = stream();
+      add_particles_random(a,nb,p,rng);
     }
 
     unsigned int add_electrons_random(AreaRef a) {
-      auto e = std::back_inserter(electrons);
-      return add_particles_random(a,e);
+      electrons_changed();
+      auto e   = std::back_inserter(electrons);
+      auto rng = stream();
+      return add_particles_random(a,e,rng);
     }
 
     void add_electrons_random(AreaRef a,  unsigned int nb) {
-      auto e = std::back_inserter(electrons);
-      add_particles_random(a,nb,e);
+      electrons_changed();
+      auto e   = std::back_inserter(electrons);
+      auto rng = stream();
+      add_particles_random(a,nb,e,rng);
     }
 
     void build_protons(unsigned int idf) {
+      protons_changed();
       auto& area = areas[idf];
       auto  p    = std::back_inserter(protons);
-      area.second = elec::add_particles_random(area.first,p);
+      auto  rng  = stream();
+      area.second = elec::add_particles_random(area.first,p,rng);
     }
 
     void build_electrons(unsigned int idf) {
+      electrons_changed();
       auto& area = areas[idf];
       auto  e    = std::back_inserter(electrons);
-      elec::add_particles_random(area.first,area.second,e);
+      auto  rng  = stream();
+      elec::add_particles_random(area.first,area.second,e,rng);
     }
 
     unsigned int nb_protons(unsigned int idf) {
@@ -208,20 +1318,25 @@ namespace elec {
     }
 
     void build_protons() {
+      protons_changed();
+      auto rng = stream();
       for(auto& area : areas) 
 	if(area.second == 0) {
 	  auto p = std::back_inserter(protons);
-	  area.second = elec::add_particles_random(area.first,p);
+	  area.second = elec::add_particles_random(area.first,p,rng);
 	}
     }
 
     void build() {
+      protons_changed();
+      electrons_changed();
+      auto rng = stream();
       for(auto& area : areas) 
 	if(area.second == 0) {
 	  auto p = std::back_inserter(protons);
 	  auto e = std::back_inserter(electrons);
-	  area.second = elec::add_particles_random(area.first,p);
-	  elec::add_particles_random(area.first,area.second,e);
+	  area.second = elec::add_particles_random(area.first,p,rng);
+	  elec::add_particles_random(area.first,area.second,e,rng);
 	}
     }
 
@@ -273,10 +1388,16 @@ namespace elec {
 			       zmin = vmin;
 			       zmax = vmax;
 			       nb_z = nb_contours;
-			       auto outz = std::back_inserter(z);
-			       for(auto y : ccmpl::range(ymin, ymax, nb_y))
-				 for(auto x : ccmpl::range(xmin, xmax, nb_x))
-				   *(outz++) = V(Point(x,y));
+			       std::vector<double> xs, ys;
+			       for(auto y : ccmpl::range(ymin, ymax, nb_y)) ys.push_back(y);
+			       for(auto x : ccmpl::range(xmin, xmax, nb_x)) xs.push_back(x);
+			       z.resize(xs.size()*ys.size());
+			       this->update_fields();
+			       this->parallel_for(ys.size(), [this, &xs, &ys, &z](std::size_t j) {
+				   std::vector<Point> at;
+				   for(auto x : xs) at.push_back(Point(x,ys[j]));
+				   this->fill_V_batch(at.data(), z.data() + j*xs.size(), at.size());
+				 });
 			     });
     }
     
@@ -286,14 +1407,28 @@ namespace elec {
       return ccmpl::vectors("zorder=1,color='blue',pivot='tail',scale=1.0",
 			    [this, coef, nb_X, nb_Y, plot_inside](std::vector<std::pair<ccmpl::Point,ccmpl::Point>>& vectors) {
 			      vectors.clear();
+			      std::vector<double> xs, ys;
+			      for(auto y : ccmpl::range(this->limits2d.ymin, this->limits2d.ymax, nb_Y)) ys.push_back(y);
+			      for(auto x : ccmpl::range(this->limits2d.xmin, this->limits2d.xmax, nb_X)) xs.push_back(x);
+			      std::vector<std::vector<Point>> at(ys.size()), field_at(ys.size());
+			      this->update_fields();
+			      const Area& area = this->geometry();
+			      this->parallel_for(ys.size(), [this, plot_inside, &area, &xs, &ys, &at, &field_at](std::size_t j) {
+				  for(auto x : xs) {
+				    auto p = Point(x,ys[j]);
+				    if(plot_inside || !(area.in(p)))
+				      at[j].push_back(p);
+				  }
+				  field_at[j].resize(at[j].size());
+				  this->fill_E_batch(at[j].data(), field_at[j].data(), at[j].size());
+				});
 			      auto outv = std::back_inserter(vectors);
-			      for(auto y : ccmpl::range(this->limits2d.ymin, this->limits2d.ymax, nb_Y))
-				for(auto x : ccmpl::range(this->limits2d.xmin, this->limits2d.xmax, nb_X)) {
-				  auto p = Point(x,y);
-				  if(plot_inside || !(this->all.in(p)))
-				    *(outv++) = {Point(x,y),E(Point(x,y))*coef};
-				}
+			      for(std::size_t j = 0; j < ys.size(); ++j)
+				for(std::size_t i = 0; i < at[j].size(); ++i)
+				  *(outv++) = {at[j][i],field_at[j][i]*coef};
 			    });
     }
   };
+
+  using World = basic_world<double>;
 }
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <elec.hpp>
+
+// The world of example-001, shared by the tests: two disks joined by
+// a bar, with twice as many electrons as protons, all of them in the
+// left disk at first.
+
+#define RADIUS1 1.5
+#define RADIUS2 1.0
+#define RADIUS3 0.2
+
+#define ELECTRONS_RATIO 2
+
+template<typename WORLD>
+void build_scene(WORLD& world, unsigned int seed) {
+  auto material = elec::material(1.0,.33,.05);
+
+  auto left  = elec::disk(elec::Point(-RADIUS1,        0),                       RADIUS2, material);
+  auto right = elec::disk(elec::Point( RADIUS1,        0),                       RADIUS2, material);
+  auto bar   = elec::box (elec::Point(-RADIUS1, -RADIUS3), elec::Point(RADIUS1, RADIUS3), material);
+  auto group = elec::set ({left,bar,right});
+
+  world.set_seed(seed);
+  auto group_idf = (world += group);
+  world.build_protons(group_idf);
+  world.add_electrons_random(left, ELECTRONS_RATIO * world.nb_protons(group_idf));
+}
@@ -24,6 +24,7 @@ int main(int argc, char* argv[]) {
   auto group = elec::set ({left,right,bar});
 
   elec::World world;
+  world.set_seed(m.seed());
   auto group_idf = (world += group);
   world.build_protons(group_idf);
   world.add_electrons_random(left);
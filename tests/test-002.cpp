@@ -33,6 +33,7 @@ int main(int argc, char* argv[]) {
   auto r_mat3  = elec::box({-RADIUS4, -RADIUS6}, {RADIUS4, RADIUS6}, elec::material(LOW_MOBILITY, LOW_DENSITY, HIGH_MIN_DIST     ));
 
   elec::World world;
+  world.set_seed(m.seed());
 
   auto rbag   = elec::hflip(lbag,0);
 
@@ -19,6 +19,7 @@ int main(int argc, char* argv[]) {
   auto dsk = elec::disk({RADIUS1+RADIUS3, 0}, RADIUS3, elec::metal());
 
   elec::World world;
+  world.set_seed(m.seed());
   world += bar;
   world += dsk;
   auto src_idf = (world += src);
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <elec.hpp>
+#include "scene.hpp"
+
+// Runs the world of example-001 with double and float particle
+// storage, from the same initial state and with the same random
+// draws, and checks that the float storage keeps the dynamics: the
+// mean abscissa of the electrons should not drift away. The drift of
+// the electrons themselves is printed: the noise makes each
+// trajectory diverge from the first rounding difference.
+
+#define NB_STEPS        750
+#define PRINT_PERIOD     50
+#define SEED             42
+#define MAX_MEAN_DRIFT   .02
+
+// Time of the field computation alone, at the electrons.
+template<typename WORLD>
+double field(WORLD& world) {
+  std::vector<elec::Point> at, E;
+  for(auto& c : world.charges(false)) at.push_back(c.pos);
+  E.resize(at.size());
+  auto start = std::chrono::steady_clock::now();
+  world.E_batch(at.data(), E.data(), at.size());
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename WORLD>
+double step(WORLD& world) {
+  auto start = std::chrono::steady_clock::now();
+  world.move();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+  elec::World              world_d;
+  elec::basic_world<float> world_f;
+  build_scene(world_d, SEED);
+  build_scene(world_f, SEED);
+
+  double time_d = 0, time_f = 0, worst_drift = 0;
+  std::cout << "step   rms drift   max drift   mean x (double)  mean x (float)" << std::endl;
+  for(unsigned int s = 1; s <= NB_STEPS; ++s) {
+    time_d += step(world_d);
+    time_f += step(world_f);
+    if(s % PRINT_PERIOD == 0 || s == NB_STEPS) {
+      auto ed = world_d.charges(false);
+      auto ef = world_f.charges(false);
+      double rms = 0, max = 0, xd = 0, xf = 0;
+      for(unsigned int i = 0; i < ed.size(); ++i) {
+	double d2 = elec::d2(ed[i].pos, ef[i].pos);
+	rms += d2;
+	max  = std::max(max, d2);
+	xd  += ed[i].pos.x;
+	xf  += ef[i].pos.x;
+      }
+      worst_drift = std::max(worst_drift, std::fabs(xd - xf)/ed.size());
+      std::cout << std::setw(4)  << s
+		<< ' ' << std::setw(11) << std::sqrt(rms/ed.size())
+		<< ' ' << std::setw(11) << std::sqrt(max)
+		<< ' ' << std::setw(16) << xd/ed.size()
+		<< ' ' << std::setw(15) << xf/ef.size() << std::endl;
+    }
+  }
+  std::cout << "time per step: double " << time_d/NB_STEPS
+	    << "s, float " << time_f/NB_STEPS << 's' << std::endl;
+  std::cout << "field at the electrons: double " << field(world_d)
+	    << "s, float " << field(world_f) << 's' << std::endl;
+  bool ok = worst_drift < MAX_MEAN_DRIFT;
+  std::cout << "largest drift of the mean x " << worst_drift
+	    << (ok ? " (within bounds)" : " (OUT OF BOUNDS)") << std::endl;
+  return ok ? 0 : 1;
+}
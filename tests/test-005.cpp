@@ -0,0 +1,119 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <elec.hpp>
+#include "scene.hpp"
+
+// Runs the world of example-001 from several initial states, with the
+// sequential move and with the tiled parallel move (see
+// World::set_tiled_move), and compares the statistics of the electron
+// distribution over the runs. With large tiles, the two moves should
+// not be told apart. The tiles of the minimal size, which give the
+// most parallelism, slow the transient down a bit: the test checks
+// that the right disk fills at least MIN_PROGRESS as fast.
+
+#define NB_RUNS           6
+#define NB_STEPS        100
+#define PRINT_PERIOD     50
+#define SEED             42
+
+#define LARGE_TILES       1
+#define SMALL_TILES    1e-9 // enlarged to the minimal size.
+#define MIN_PROGRESS    .85 // of the right disk proportion, tiled over sequential.
+
+// The observables: the mean abscissa of the electrons, and the
+// proportion of them in the right disk.
+struct Stats {
+  double x[NB_RUNS], right[NB_RUNS];
+
+  void set(unsigned int run, elec::World& world) {
+    auto e = world.charges(false);
+    x[run] = right[run] = 0;
+    for(auto& c : e) {
+      x[run] += c.pos.x;
+      if(c.pos.x > RADIUS1 - RADIUS2) right[run] += 1;
+    }
+    x[run]     /= e.size();
+    right[run] /= e.size();
+  }
+};
+
+void mean_var(const double* v, double& mean, double& var) {
+  mean = var = 0;
+  for(unsigned int r = 0; r < NB_RUNS; ++r) mean += v[r];
+  mean /= NB_RUNS;
+  for(unsigned int r = 0; r < NB_RUNS; ++r) var += (v[r]-mean)*(v[r]-mean);
+  var /= NB_RUNS - 1;
+}
+
+// Welch's statistic of the difference of the means.
+double welch(const double* a, const double* b) {
+  double ma, va, mb, vb;
+  mean_var(a, ma, va);
+  mean_var(b, mb, vb);
+  double se = std::sqrt((va + vb)/NB_RUNS);
+  return se > 0 ? (ma - mb)/se : 0;
+}
+
+// The largest |t| over the steps, between the sequential runs and
+// the tiled ones. progress is set to the smallest ratio of the mean
+// right disk proportions, tiled over sequential.
+double compare(const char* name, double tile_size, double& progress) {
+  std::vector<elec::World> sequential(NB_RUNS), tiled(NB_RUNS);
+  for(unsigned int r = 0; r < NB_RUNS; ++r) {
+    build_scene(sequential[r], SEED + r);
+    build_scene(tiled[r], SEED + r);
+    tiled[r].set_tiled_move(tile_size);
+  }
+
+  double worst = 0;
+  progress = 1;
+  Stats s, t;
+  std::cout << name << std::endl
+	    << "step  mean x (seq)  mean x (tiled)  t(x)   right (seq)  right (tiled)  t(right)" << std::endl;
+  for(unsigned int step = 1; step <= NB_STEPS; ++step) {
+    for(unsigned int r = 0; r < NB_RUNS; ++r) {
+      sequential[r].move();
+      tiled[r].move();
+    }
+    if(step % PRINT_PERIOD == 0) {
+      for(unsigned int r = 0; r < NB_RUNS; ++r) {
+	s.set(r, sequential[r]);
+	t.set(r, tiled[r]);
+      }
+      double ms, mt, rs, rt, v;
+      mean_var(s.x, ms, v);
+      mean_var(t.x, mt, v);
+      mean_var(s.right, rs, v);
+      mean_var(t.right, rt, v);
+      double tx = welch(s.x, t.x);
+      double tr = welch(s.right, t.right);
+      worst = std::max({worst, std::fabs(tx), std::fabs(tr)});
+      if(rs > 0)
+	progress = std::min(progress, rt/rs);
+      std::cout << std::setw(4)  << step
+		<< ' ' << std::setw(13) << ms
+		<< ' ' << std::setw(15) << mt
+		<< ' ' << std::setw(5)  << std::setprecision(2) << tx
+		<< ' ' << std::setw(13) << std::setprecision(6) << rs
+		<< ' ' << std::setw(14) << rt
+		<< ' ' << std::setw(9)  << std::setprecision(2) << tr
+		<< std::setprecision(6) << std::endl;
+    }
+  }
+  return worst;
+}
+
+int main() {
+  // With 6 runs, |t| > 3.5 happens by chance with a probability of
+  // about 1%.
+  double large_progress, small_progress;
+  double large = compare("large tiles", LARGE_TILES, large_progress);
+  double small = compare("minimal tiles", SMALL_TILES, small_progress);
+  bool   ok_large = large < 3.5;
+  bool   ok_small = small_progress >= MIN_PROGRESS;
+  std::cout << "largest |t|, large tiles: " << large << (ok_large ? " (equivalent)" : " (NOT equivalent)") << std::endl
+	    << "largest |t|, minimal tiles: " << small << (small < 3.5 ? " (equivalent)" : " (biased)")
+	    << ", progress " << small_progress << (ok_small ? " (within bounds)" : " (TOO SLOW)") << std::endl;
+  return ok_large && ok_small ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <elec.hpp>
+#include "scene.hpp"
+
+// Runs the world of example-001, without dipoles, with a Barnes-Hut
+// engine (not incremental), under each move, and checks that the
+// engine follows the electrons: after the moves, the field of the
+// world at the electrons should be the one of the direct summation.
+
+#define NB_STEPS         10
+#define SEED             42
+#define MAX_ERROR      1e-2
+
+// The rms error of the field of the world, relative to the direct
+// summation, at the electrons.
+double error(elec::World& world) {
+  double err = 0, ref = 0;
+  for(auto& c : world.charges(false)) {
+    elec::Point exact = world.E_direct(c.pos);
+    err += elec::d2(world.E(c.pos), exact);
+    ref += exact*exact;
+  }
+  return std::sqrt(err/ref);
+}
+
+int main() {
+  const char* names[] = {"sequential", "jacobi", "tiled"};
+  bool ok = true;
+  for(unsigned int mode = 0; mode < 3; ++mode) {
+    elec::World world;
+    build_scene(world, SEED);
+    world.set_field(elec::barnes_hut(.3,4,8));
+    switch(mode) {
+    case 1: world.set_parallel_move(true); break;
+    case 2: world.set_tiled_move(1);       break;
+    }
+    double before = error(world);
+    for(unsigned int s = 0; s < NB_STEPS; ++s)
+      world.move();
+    double after = error(world);
+    bool good = after < MAX_ERROR;
+    ok = ok && good;
+    std::cout << std::setw(10) << names[mode]
+	      << "  field error: " << std::setw(11) << before
+	      << " before, " << std::setw(11) << after << " after " << NB_STEPS << " moves"
+	      << (good ? "" : " (STALE)") << std::endl;
+  }
+  return ok ? 0 : 1;
+}
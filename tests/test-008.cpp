@@ -0,0 +1,67 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <elec.hpp>
+#include "scene.hpp"
+
+// Settles the world of example-001, then moves it on without and
+// with sleeping electrons (see World::set_sleep), and checks that
+// the settled electrons do fall asleep: fewer electrons are moved,
+// and each move takes less time, while the share of the electrons in
+// the right disk holds.
+
+#define NB_SETTLE_STEPS 600
+#define NB_STEPS        200
+#define SEED             42
+
+#define SLEEP_STEPS       5
+#define MAX_AWAKE        .85 // of the electrons, on average over the last half of the steps.
+#define MAX_RIGHT_CHANGE .02
+
+double right_share(elec::World& world) {
+  auto charges = world.charges(false);
+  double nb = 0;
+  for(auto& c : charges)
+    if(c.pos.x > 0) ++nb;
+  return nb/charges.size();
+}
+
+// Runs NB_STEPS moves, returning the time per move, and the number
+// of awake electrons on average over the last half of them.
+double run(elec::World& world, double& awake) {
+  awake = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(unsigned int s = 0; s < NB_STEPS; ++s) {
+    world.move();
+    if(2*s >= NB_STEPS)
+      awake += world.nb_awake();
+  }
+  awake /= NB_STEPS - NB_STEPS/2;
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()/NB_STEPS;
+}
+
+int main() {
+  elec::World world;
+  build_scene(world, SEED);
+  for(unsigned int s = 0; s < NB_SETTLE_STEPS; ++s)
+    world.move();
+  double nb = world.charges(false).size();
+  double settled = right_share(world);
+
+  double awake_on, awake_off;
+  double time_off = run(world, awake_off);
+  double right_off = right_share(world);
+  world.set_sleep(SLEEP_STEPS);
+  double time_on = run(world, awake_on);
+  double right_on = right_share(world);
+
+  std::cout << "right disk share: " << settled << " settled, "
+	    << right_off << " without sleep, " << right_on << " with sleep" << std::endl
+	    << "awake electrons:  " << awake_off/nb << " without sleep, " << awake_on/nb << " with sleep" << std::endl
+	    << "time per step:    " << time_off << "s without sleep, " << time_on << "s with sleep" << std::endl;
+  bool ok = awake_on < MAX_AWAKE*nb && time_on < time_off
+    && std::fabs(right_on - settled) < MAX_RIGHT_CHANGE;
+  std::cout << (ok ? "sleep saves work" : "NO SAVING, OR THE WORLD CHANGED") << std::endl;
+  return ok ? 0 : 1;
+}